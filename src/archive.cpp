@@ -9,9 +9,7 @@ archive_(cpp11::sexp connection, cpp11::strings options, cpp11::strings password
 
   local_utf8_locale ll;
 
-  std::vector<std::string> paths;
-  std::vector<__LA_INT64_T> sizes;
-  std::vector<time_t> dates;
+  archive_listing listing;
 
   struct archive* a;
   struct archive_entry* entry;
@@ -19,6 +17,7 @@ archive_(cpp11::sexp connection, cpp11::strings options, cpp11::strings password
   a = archive_read_new();
   call(archive_read_support_filter_all, a);
   call(archive_read_support_format_all, a);
+  archive_read_concatenated(a);
 
   if (options.size() > 0) {
     call(archive_read_set_options, a, std::string(options[0]).c_str());
@@ -31,23 +30,27 @@ archive_(cpp11::sexp connection, cpp11::strings options, cpp11::strings password
   r->buf.resize(16384);
   r->connection = connection;
 
-  call(archive_read_set_read_callback, a, input_read);
-  call(archive_read_set_close_callback, a, input_close);
-  static auto isSeekable = cpp11::package("base")["isSeekable"];
-  if (isSeekable(connection)) {
-    call(archive_read_set_seek_callback, a, input_seek);
-  }
-  call(archive_read_set_callback_data, a, r.get());
-  call(archive_read_open1, a);
+  archive_read_open_input(a, r.get());
 
   while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
-    paths.push_back(archive_entry_pathname(entry));
-    sizes.push_back(archive_entry_size(entry));
-    dates.push_back(archive_entry_mtime(entry));
+    listing.add(
+        archive_entry_pathname(entry),
+        archive_entry_size(entry),
+        archive_entry_mtime(entry));
     call(archive_read_data_skip, a);
   }
   call(archive_read_free, a);
 
+  return listing.as_tibble();
+}
+
+void archive_listing::add(const char* path, int64_t size, time_t date) {
+  paths.push_back(path);
+  sizes.push_back(size);
+  dates.push_back(date);
+}
+
+SEXP archive_listing::as_tibble() const {
   static auto as_tibble = cpp11::package("tibble")["as_tibble"];
   cpp11::writable::doubles d(dates);
   d.attr("class") = {"POSIXct", "POSIXt"};
@@ -60,6 +63,25 @@ archive_(cpp11::sexp connection, cpp11::strings options, cpp11::strings password
   return as_tibble(out);
 }
 
+void archive_detect(
+    struct archive* a, int& format, std::vector<int>& filters) {
+  format = archive_format(a);
+
+  /* The last filter is always the 'none' pass through filter, the others are
+   * numbered starting from the one closest to the format. */
+  filters.clear();
+  int num_filters = archive_filter_count(a);
+  for (int i = 0; i < num_filters - 1; ++i) {
+    filters.push_back(archive_filter_code(a, i));
+  }
+}
+
+void archive_read_concatenated(struct archive* a) {
+#if ARCHIVE_VERSION_NUMBER >= 3002000
+  archive_read_set_format_option(a, "tar", "read_concatenated_archives", "1");
+#endif
+}
+
 [[cpp11::register]] cpp11::integers archive_filters() {
   cpp11::writable::integers out({
     "none"_nm = ARCHIVE_FILTER_NONE, "gzip"_nm = ARCHIVE_FILTER_GZIP,
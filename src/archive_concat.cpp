@@ -0,0 +1,220 @@
+#include "r_archive.h"
+#include "zip.h"
+#include <algorithm>
+#include <cerrno>
+#include <cli/progress.h>
+#include <cstring>
+
+const char* const pb_format =
+    "{cli::pb_spin} %zu added | {cli::pb_current_bytes} "
+    "({cli::pb_rate_bytes}) | "
+    "{cli::pb_elapsed}";
+
+static const size_t TAR_BLOCK_SIZE = 512;
+
+/* Filters whose streams can simply be concatenated, the decoders continue
+ * with the next gzip member, xz stream, zstd frame etc. */
+static bool is_concatenable(int filter) {
+  switch (filter) {
+  case ARCHIVE_FILTER_GZIP:
+  case ARCHIVE_FILTER_BZIP2:
+  case ARCHIVE_FILTER_XZ:
+  case ARCHIVE_FILTER_LZIP:
+#if ARCHIVE_VERSION_NUMBER >= 3002000
+  case ARCHIVE_FILTER_LZ4:
+#endif
+#if ARCHIVE_VERSION_NUMBER >= 3003003
+  case ARCHIVE_FILTER_ZSTD:
+#endif
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void
+detect_tar(const std::string& filename, std::vector<int>& filters) {
+  std::unique_ptr<struct archive, int (*)(struct archive*)> a(
+      archive_read_new(), archive_read_free);
+
+  int format;
+  std::string bad_filter;
+  /* Turn the longjmp of an error into an exception, so `a` is freed */
+  cpp11::unwind_protect([&] {
+    call(archive_read_support_filter_all, a.get());
+    call(archive_read_support_format_all, a.get());
+    call(archive_read_open_filename, a.get(), filename.c_str(), 16384);
+
+    struct archive_entry* entry;
+    call(archive_read_next_header, a.get(), &entry);
+
+    archive_detect(a.get(), format, filters);
+
+    for (size_t i = 0; i < filters.size(); ++i) {
+      if (!is_concatenable(filters[i])) {
+        bad_filter = archive_filter_name(a.get(), i);
+      }
+    }
+  });
+
+  if ((format & ARCHIVE_FORMAT_BASE_MASK) != ARCHIVE_FORMAT_TAR) {
+    cpp11::stop("'%s' is not a tar archive", filename.c_str());
+  }
+  if (!bad_filter.empty()) {
+    cpp11::stop(
+        "'%s' uses the '%s' filter, which can't be concatenated",
+        filename.c_str(),
+        bad_filter.c_str());
+  }
+}
+
+static uint64_t parse_tar_number(const unsigned char* p, size_t n) {
+  /* GNU base-256 encoding for large values */
+  if (p[0] & 0x80) {
+    uint64_t value = p[0] & 0x7F;
+    for (size_t i = 1; i < n; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+  uint64_t value = 0;
+  for (size_t i = 0; i < n && p[i] != '\0'; ++i) {
+    if (p[i] >= '0' && p[i] <= '7') {
+      value = value * 8 + (p[i] - '0');
+    }
+  }
+  return value;
+}
+
+/* The offset of the end of archive marker of an uncompressed tar file, i.e.
+ * the first zero block in place of a header */
+static uint64_t tar_data_end(FILE* fp, const std::string& filename) {
+  unsigned char block[TAR_BLOCK_SIZE];
+  static const unsigned char zeros[TAR_BLOCK_SIZE] = {0};
+  uint64_t pos = 0;
+  for (;;) {
+    if (zip_fseek(fp, pos, SEEK_SET) != 0 ||
+        fread(block, 1, TAR_BLOCK_SIZE, fp) != TAR_BLOCK_SIZE) {
+      /* No end of archive marker, all of the file is data */
+      return pos;
+    }
+    if (memcmp(block, zeros, TAR_BLOCK_SIZE) == 0) {
+      return pos;
+    }
+    pos += TAR_BLOCK_SIZE;
+
+    char type = block[156];
+    uint64_t size = parse_tar_number(block + 124, 12);
+
+    /* Old GNU sparse files can have extension headers after the header */
+    bool extended = type == 'S' && block[482] != 0;
+    while (extended) {
+      if (fread(block, 1, TAR_BLOCK_SIZE, fp) != TAR_BLOCK_SIZE) {
+        cpp11::stop("Unexpected end of tar file '%s'", filename.c_str());
+      }
+      pos += TAR_BLOCK_SIZE;
+      extended = block[504] != 0;
+    }
+
+    /* Links, devices, directories and fifos have no data */
+    if (type >= '1' && type <= '6') {
+      size = 0;
+    }
+    pos += (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+  }
+}
+
+// Concatenate tar archives, without decompressing and recompressing them.
+[[cpp11::register]] void archive_concat_(
+    cpp11::strings archive_filenames,
+    const std::string& output_filename,
+    size_t sz = 1048576) {
+
+  local_utf8_locale ll;
+
+  R_xlen_t n = archive_filenames.size();
+
+  std::vector<std::string> filenames;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    filenames.push_back(archive_filenames[i]);
+  }
+
+  std::vector<int> filters;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    std::vector<int> shard_filters;
+    detect_tar(filenames[i], shard_filters);
+    if (i == 0) {
+      filters = shard_filters;
+    } else if (shard_filters != filters) {
+      cpp11::stop(
+          "'%s' and '%s' use different filters",
+          filenames[0].c_str(),
+          filenames[i].c_str());
+    }
+  }
+
+  std::unique_ptr<FILE, int (*)(FILE*)> out(
+      fopen(output_filename.c_str(), "wb"), fclose);
+  if (out == nullptr) {
+    cpp11::stop(
+        "Could not open '%s' for writing: %s",
+        output_filename.c_str(),
+        strerror(errno));
+  }
+
+  std::vector<char> buf(sz);
+
+  cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
+
+  uint64_t total_written = 0;
+
+  for (R_xlen_t i = 0; i < n; ++i) {
+    std::unique_ptr<FILE, int (*)(FILE*)> in(
+        fopen(filenames[i].c_str(), "rb"), fclose);
+    if (in == nullptr) {
+      cpp11::stop(
+          "Could not open '%s': %s", filenames[i].c_str(), strerror(errno));
+    }
+
+    /* Compressed shards are copied whole, as a multi-member stream, the
+     * readers skip the end of archive markers inside it. Uncompressed ones
+     * are copied without their end of archive marker, except for the last
+     * one. */
+    uint64_t size = UINT64_MAX;
+    if (filters.empty() && i < n - 1) {
+      size = tar_data_end(in.get(), filenames[i]);
+      zip_fseek(in.get(), 0, SEEK_SET);
+    }
+
+    while (size > 0) {
+      size_t len = fread(
+          buf.data(), 1, (size_t)std::min<uint64_t>(size, buf.size()), in.get());
+      if (len == 0) {
+        break;
+      }
+      if (fwrite(buf.data(), 1, len, out.get()) != len) {
+        cpp11::stop(
+            "Could not write to '%s': %s",
+            output_filename.c_str(),
+            strerror(errno));
+      }
+      size -= len;
+      total_written += len;
+
+      if (CLI_SHOULD_TICK) {
+        cli_progress_set_format(progress_bar, pb_format, (size_t)i);
+        cli_progress_set(progress_bar, total_written);
+      }
+    }
+    if (ferror(in.get())) {
+      cpp11::stop("Could not read '%s'", filenames[i].c_str());
+    }
+  }
+
+  if (fclose(out.release()) != 0) {
+    cpp11::stop(
+        "Could not write to '%s': %s", output_filename.c_str(), strerror(errno));
+  }
+
+  cli_progress_done(progress_bar);
+}
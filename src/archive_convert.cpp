@@ -0,0 +1,383 @@
+#include "r_archive.h"
+#include "write_filters.h"
+#include "ordered_workers.h"
+#include <algorithm>
+#include <cli/progress.h>
+#include <memory>
+
+const char* const pb_format =
+    "{cli::pb_spin} %zu converted | {cli::pb_current_bytes} "
+    "({cli::pb_rate_bytes}) | "
+    "{cli::pb_elapsed}";
+
+/* Formats which can write entries whose size is not known up front */
+static bool supports_unknown_size(int format) {
+  int base = format & ARCHIVE_FORMAT_BASE_MASK;
+  return base == ARCHIVE_FORMAT_ZIP || base == ARCHIVE_FORMAT_RAW;
+}
+
+/* Write the data block `buff` at `offset`, filling any gap since the last
+ * block (e.g. holes in sparse files) with zeros */
+static void write_data_block(
+    struct archive* aw,
+    const void* buff,
+    size_t size,
+    int64_t offset,
+    int64_t& position) {
+  static const char zeros[16384] = {0};
+  while (position < offset) {
+    size_t n = (size_t)std::min<int64_t>(offset - position, sizeof(zeros));
+    call(archive_write_data, aw, zeros, n);
+    position += n;
+  }
+  call(archive_write_data, aw, buff, size);
+  position += size;
+}
+
+/* Something read from the input archive: the header of an entry which is
+ * converted, one of its data blocks, the end of its data or the end of the
+ * archive */
+struct convert_item {
+  enum kind_t { HEADER, DATA, END_OF_ENTRY, END_OF_ARCHIVE };
+  kind_t kind = END_OF_ARCHIVE;
+  std::shared_ptr<struct archive_entry> entry;
+  std::vector<char> data;
+  int64_t offset = 0;
+  /* a libarchive warning or error, which is reported on the main thread */
+  std::string warning;
+  std::string error;
+};
+
+/* Reads the entries of `a` which are converted, with their paths stripped,
+ * one item at a time. It doesn't call R, so can run on a worker thread. */
+class convert_reader {
+private:
+  struct archive* a_;
+  const entry_selection& selection_;
+  int num_strip_components_;
+  R_xlen_t index_ = 0;
+  size_t num_selected_ = 0;
+  bool in_entry_ = false;
+  bool finished_ = false;
+
+  bool failed(int response, convert_item& item) {
+    if (response >= ARCHIVE_OK) {
+      return false;
+    }
+    const char* msg = archive_error_string(a_);
+    if (response == ARCHIVE_WARN) {
+      if (msg) {
+        item.warning = msg;
+      }
+      return false;
+    }
+    item.error = msg ? msg : "unknown libarchive error";
+    finished_ = true;
+    return true;
+  }
+
+  void read_block(convert_item& item) {
+    const void* buff;
+    size_t size;
+    int64_t offset;
+    int response = archive_read_data_block(a_, &buff, &size, &offset);
+    if (response == ARCHIVE_EOF) {
+      in_entry_ = false;
+      finished_ = selection_.done(num_selected_);
+      item.kind = convert_item::END_OF_ENTRY;
+      return;
+    }
+    if (failed(response, item)) {
+      return;
+    }
+    const char* p = static_cast<const char*>(buff);
+    item.kind = convert_item::DATA;
+    item.data.assign(p, p + size);
+    item.offset = offset;
+  }
+
+public:
+  convert_reader(
+      struct archive* a,
+      const entry_selection& selection,
+      int num_strip_components)
+      : a_(a),
+        selection_(selection),
+        num_strip_components_(num_strip_components) {}
+
+  void next(convert_item& item) {
+    if (finished_) {
+      return;
+    }
+    if (in_entry_) {
+      read_block(item);
+      return;
+    }
+    for (;;) {
+      struct archive_entry* entry;
+      int response = archive_read_next_header(a_, &entry);
+      if (response == ARCHIVE_EOF) {
+        finished_ = true;
+        return;
+      }
+      if (failed(response, item)) {
+        return;
+      }
+      ++index_;
+
+      const char* filename = archive_entry_pathname(entry);
+      const char* original_filename = filename;
+      if (num_strip_components_ > 0) {
+        filename = strip_components(filename, num_strip_components_);
+        if (filename == nullptr) {
+          continue;
+        }
+      }
+
+      if (!selection_.matches(index_, filename)) {
+        continue;
+      }
+
+      /* Also strip hard link targets, like bsdtar does */
+      const char* hardlink = archive_entry_hardlink(entry);
+      const char* stripped_hardlink = nullptr;
+      if (num_strip_components_ > 0 && hardlink != nullptr) {
+        stripped_hardlink = strip_components(hardlink, num_strip_components_);
+        if (stripped_hardlink == nullptr) {
+          continue;
+        }
+      }
+
+      item.kind = convert_item::HEADER;
+      item.entry.reset(archive_entry_clone(entry), archive_entry_free);
+      if (filename != original_filename) {
+        archive_entry_copy_pathname(item.entry.get(), filename);
+      }
+      if (stripped_hardlink != nullptr) {
+        archive_entry_copy_hardlink(item.entry.get(), stripped_hardlink);
+      }
+      ++num_selected_;
+      in_entry_ = true;
+      return;
+    }
+  }
+};
+
+/* The number of items the worker thread decodes ahead of the writer */
+static const size_t CONVERT_READ_AHEAD = 16;
+
+/* Append `size` bytes of `buff` at `offset` to the temporary file `tmp`, used
+ * for entries whose size must be known before the header is written */
+static void spill_data_block(
+    FILE* tmp, const char* buff, size_t size, int64_t offset, int64_t& position) {
+  static const char zeros[16384] = {0};
+  while (position < offset) {
+    size_t n = (size_t)std::min<int64_t>(offset - position, sizeof(zeros));
+    if (fwrite(zeros, 1, n, tmp) != n) {
+      cpp11::stop("Could not write to temporary file");
+    }
+    position += n;
+  }
+  if (fwrite(buff, 1, size, tmp) != size) {
+    cpp11::stop("Could not write to temporary file");
+  }
+  position += size;
+}
+
+// Read entries from one archive and write them to a new one, e.g. to change
+// the format or filters, without extracting them to disk.
+[[cpp11::register]] cpp11::strings archive_convert_(
+    const cpp11::sexp& connection,
+    cpp11::sexp output,
+    int format,
+    cpp11::integers filters,
+    cpp11::sexp file,
+    int num_strip_components,
+    cpp11::strings read_options,
+    cpp11::strings options,
+    cpp11::strings password,
+    int threads = 1,
+    size_t sz = 16384) {
+  local_utf8_locale ll;
+
+  std::unique_ptr<input_data> r(new input_data);
+  r->buf.resize(sz);
+  r->connection = connection;
+
+  std::string read_opts;
+  if (read_options.size() > 0) {
+    read_opts = read_options[0];
+  }
+  std::string read_password;
+  if (!cpp11::is_na(password[0])) {
+    read_password = password[0];
+  }
+  std::string write_options;
+  if (options.size() > 0) {
+    write_options = options[0];
+  }
+
+  std::vector<int> filter_codes(filters.begin(), filters.end());
+
+  entry_selection selection(file);
+
+  std::unique_ptr<struct archive, int (*)(struct archive*)> a(
+      archive_read_new(), archive_read_free);
+
+  /* Turn the longjmp of an error into an exception, so `a` is freed */
+  cpp11::unwind_protect([&] {
+    call(archive_read_support_format_all, a.get());
+    archive_read_concatenated(a.get());
+    call(archive_read_support_filter_all, a.get());
+
+    if (!read_opts.empty()) {
+      call(archive_read_set_options, a.get(), read_opts.c_str());
+    }
+
+    if (!cpp11::is_na(password[0])) {
+      call(archive_read_add_passphrase, a.get(), read_password.c_str());
+    }
+
+    archive_read_open_input(a.get(), r.get());
+  });
+
+  convert_reader reader(a.get(), selection, num_strip_components);
+
+  /* Archives read natively (from a file, a mapping or a raw vector) are
+   * decoded on a worker thread while the main thread encodes, reading a
+   * connection calls R so must stay on the main thread */
+  std::unique_ptr<ordered_workers<convert_item>> read_ahead;
+
+  bool unknown_size_ok = supports_unknown_size(format);
+
+  cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
+
+  size_t total_read = 0;
+
+  size_t num_converted = 0;
+
+  std::vector<char> buf(sz);
+
+  cpp11::writable::strings converted_files;
+
+  /* Kept outside of the unwind_protect() blocks, so they are destroyed when
+   * an error unwinds */
+  parallel_filter pf;
+  convert_item item;
+  std::shared_ptr<struct archive_entry> entry;
+  /* The temporary file of an entry whose size is not known, but must be
+   * written in its header */
+  std::unique_ptr<FILE, int (*)(FILE*)> tmp(nullptr, fclose);
+  int64_t position = 0;
+
+  struct archive* out = archive_write_new();
+
+  try {
+    cpp11::unwind_protect([&] {
+      call(archive_write_set_format, out, format);
+
+      pf = archive_write_add_filters(out, filter_codes, threads, write_options);
+
+      archive_write_set_filter_options(out, write_options, pf);
+
+      archive_write_open_output(out, output, pf);
+    });
+
+    if (TYPEOF(connection) == STRSXP || TYPEOF(connection) == RAWSXP) {
+      read_ahead.reset(new ordered_workers<convert_item>(
+          SIZE_MAX,
+          1,
+          CONVERT_READ_AHEAD,
+          [&reader](size_t, convert_item& item) { reader.next(item); }));
+    }
+
+    cpp11::unwind_protect([&] {
+      for (size_t i = 0;; ++i) {
+        if (read_ahead) {
+          item = read_ahead->take(i);
+        } else {
+          item = convert_item();
+          reader.next(item);
+        }
+        if (!item.warning.empty()) {
+          archive_message(item.warning.c_str());
+        }
+        if (!item.error.empty()) {
+          cpp11::stop("%s", item.error.c_str());
+        }
+
+        if (item.kind == convert_item::END_OF_ARCHIVE) {
+          break;
+        }
+
+        if (item.kind == convert_item::HEADER) {
+          entry = item.entry;
+          position = 0;
+          converted_files.push_back(archive_entry_pathname(entry.get()));
+          if (archive_entry_filetype(entry.get()) == AE_IFREG &&
+              !archive_entry_size_is_set(entry.get()) && !unknown_size_ok) {
+            tmp.reset(tmpfile());
+            if (tmp == nullptr) {
+              cpp11::stop("Could not create a temporary file");
+            }
+          } else {
+            call(archive_write_header, out, entry.get());
+          }
+          continue;
+        }
+
+        if (item.kind == convert_item::DATA) {
+          total_read += item.data.size();
+          if (CLI_SHOULD_TICK) {
+            cli_progress_set_format(progress_bar, pb_format, num_converted);
+            cli_progress_set(progress_bar, total_read);
+          }
+          if (tmp != nullptr) {
+            spill_data_block(
+                tmp.get(),
+                item.data.data(),
+                item.data.size(),
+                item.offset,
+                position);
+          } else {
+            write_data_block(
+                out,
+                item.data.data(),
+                item.data.size(),
+                item.offset,
+                position);
+          }
+          continue;
+        }
+
+        /* The end of the entry's data */
+        if (tmp != nullptr) {
+          archive_entry_set_size(entry.get(), position);
+          call(archive_write_header, out, entry.get());
+          rewind(tmp.get());
+          size_t len;
+          while ((len = fread(buf.data(), 1, buf.size(), tmp.get())) > 0) {
+            call(archive_write_data, out, buf.data(), len);
+          }
+          tmp.reset();
+        }
+        call(archive_write_finish_entry, out);
+        entry.reset();
+
+        num_converted++;
+      }
+
+      call(archive_write_close, out);
+    });
+  } catch (...) {
+    /* Stop the worker before `a` is freed */
+    read_ahead.reset();
+    archive_write_discard(out, output);
+    throw;
+  }
+  archive_write_free(out);
+
+  cli_progress_done(progress_bar);
+
+  return converted_files;
+}
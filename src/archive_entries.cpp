@@ -0,0 +1,139 @@
+#include "r_archive.h"
+
+using namespace cpp11::literals;
+
+typedef std::shared_ptr<archive_cursor> archive_cursor_ptr;
+
+/* The connections to entries share the archive, so opening and closing one
+ * only changes its state, the archive itself is freed with the last of them
+ * and the archive_entries object */
+static Rboolean rchive_entry_open(Rconnection con) {
+  con->isopen = TRUE;
+  con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+  return TRUE;
+}
+
+static void rchive_entry_close(Rconnection con) {
+  con->isopen = FALSE;
+  con->incomplete = FALSE;
+}
+
+static void rchive_entry_destroy(Rconnection con) {
+  rchive* r = (rchive*)con->private_ptr;
+  delete r;
+}
+
+[[cpp11::register]] SEXP archive_entries_(
+    const cpp11::sexp connection,
+    const std::string& description,
+    const std::string& mode,
+    cpp11::integers format,
+    cpp11::integers filters,
+    cpp11::strings options,
+    cpp11::strings password) {
+  local_utf8_locale ll;
+
+  archive_cursor_ptr cursor = std::make_shared<archive_cursor>();
+  cursor->description = description;
+  cursor->mode = mode;
+  cursor->input.connection = connection;
+  cursor->input.buf.resize(16384);
+
+  if (filters.size() > FILTER_MAX) {
+    cpp11::stop("Cannot use more than %i filters", FILTER_MAX);
+  }
+  int filter_codes[FILTER_MAX];
+  for (int i = 0; i < FILTER_MAX; ++i) {
+    filter_codes[i] = i < filters.size() ? filters[i] : -1;
+  }
+
+  cursor->ar = archive_read_new();
+  cursor->detect = archive_read_support_input(
+      cursor->ar,
+      cursor->input,
+      format.size() == 0 ? -1 : format[0],
+      filter_codes,
+      options.size() > 0 ? std::string(options[0]) : std::string(),
+      password);
+  archive_read_open_input(cursor->ar, &cursor->input);
+
+  cpp11::sexp out(cpp11::external_pointer<archive_cursor_ptr>(
+      new archive_cursor_ptr(cursor)));
+  out.attr("class") = "archive_entries";
+  return out;
+}
+
+[[cpp11::register]] SEXP archive_next_(SEXP entries) {
+  cpp11::external_pointer<archive_cursor_ptr> xp(entries);
+  if (xp.get() == nullptr) {
+    cpp11::stop("`entries` is no longer valid");
+  }
+  archive_cursor_ptr cursor = *xp;
+  if (cursor->done) {
+    return R_NilValue;
+  }
+
+  local_utf8_locale ll;
+
+  /* libarchive skips the rest of the current entry, so the connections to
+   * earlier entries are at their end from now on */
+  archive_entry* entry;
+  int res = archive_read_next_header(cursor->ar, &entry);
+  ++cursor->index;
+  if (res == ARCHIVE_EOF) {
+    cursor->done = true;
+    /* close the archive (and its file) now, rather than when it is freed */
+    call(archive_read_close, cursor->ar);
+    return R_NilValue;
+  }
+  if (res < ARCHIVE_WARN) {
+    cursor->done = true;
+    const char* msg = archive_error_string(cursor->ar);
+    cpp11::stop("%s", msg ? msg : "unknown libarchive error");
+  }
+  if (cursor->detect && cursor->index == 1) {
+    archive_read_remember_format(cursor->ar, cursor->input);
+  }
+
+  const char* pathname = archive_entry_pathname(entry);
+  std::string path = pathname ? pathname : "";
+  std::string description =
+      "archive_read(" + cursor->description + ")[" + path + "]";
+
+  Rconnection con;
+  cpp11::sexp rc(new_connection(
+      description.c_str(), cursor->mode.c_str(), "archive_read", &con));
+
+  rchive* r = new rchive;
+  r->buf.resize(16384);
+  r->ar = cursor->ar;
+  r->entry = entry;
+  r->cursor = cursor;
+  r->cursor_index = cursor->index;
+
+  con->incomplete = TRUE;
+  con->private_ptr = r;
+  con->canseek = FALSE;
+  con->canwrite = FALSE;
+  con->isopen = FALSE;
+  con->blocking = TRUE;
+  con->UTF8out = FALSE;
+  con->open = rchive_entry_open;
+  con->close = rchive_entry_close;
+  con->destroy = rchive_entry_destroy;
+  con->read = rchive_read;
+  con->fgetc = rchive_fgetc;
+  con->fgetc_internal = rchive_fgetc;
+  con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+
+  cpp11::writable::doubles date({(double)archive_entry_mtime(entry)});
+  date.attr("class") = {"POSIXct", "POSIXt"};
+  rc.attr("path") = path;
+  /* NA rather than 0 when the header has no size, e.g. for raw streams */
+  rc.attr("size") = archive_entry_size_is_set(entry)
+                        ? (double)archive_entry_size(entry)
+                        : NA_REAL;
+  rc.attr("date") = date;
+
+  return rc;
+}
@@ -34,65 +34,6 @@ static int copy_data(
   }
 }
 
-template <typename C> std::vector<R_xlen_t> as_file_index(const C& in) {
-  std::vector<R_xlen_t> out;
-  out.reserve(in.size());
-  for (R_xlen_t value : in) {
-    out.push_back(value);
-  }
-  return out;
-}
-
-template <typename T, typename C>
-bool any_matches(const T& needle, const std::vector<C>& haystack) {
-  for (const C& n : haystack) {
-    if (n == needle) {
-      return true;
-    }
-  }
-  return false;
-}
-
-/* From
-https://github.com/libarchive/libarchive/blob/0fd2ed25d78e9f4505de5dcb6208c6c0ff8d2edb/tar/util.c#L338-L375
-*/
-static const char* strip_components(const char* p, int elements) {
-  /* Skip as many elements as necessary. */
-  while (elements > 0) {
-    switch (*p++) {
-    case '/':
-#if defined(_WIN32)
-    case '\\': /* Support \ path sep on Windows ONLY. */
-#endif
-      elements--;
-      break;
-    case '\0':
-      /* Path is too short, skip it. */
-      return (NULL);
-    }
-  }
-
-  /* Skip any / characters.  This handles short paths that have
-   * additional / termination.  This also handles the case where
-   * the logic above stops in the middle of a duplicate //
-   * sequence (which would otherwise get converted to an
-   * absolute path). */
-  for (;;) {
-    switch (*p) {
-    case '/':
-#if defined(_WIN32)
-    case '\\': /* Support \ path sep on Windows ONLY. */
-#endif
-      ++p;
-      break;
-    case '\0':
-      return (NULL);
-    default:
-      return (p);
-    }
-  }
-}
-
 [[cpp11::register]] cpp11::strings archive_extract_(
     const cpp11::sexp& connection,
     cpp11::sexp file,
@@ -121,6 +62,7 @@ static const char* strip_components(const char* p, int elements) {
   a = archive_read_new();
   call(archive_read_support_format_all, a);
   call(archive_read_support_filter_all, a);
+  archive_read_concatenated(a);
 
   if (options.size() > 0) {
     call(archive_read_set_options, a, std::string(options[0]).c_str());
@@ -130,14 +72,7 @@ static const char* strip_components(const char* p, int elements) {
     call(archive_read_add_passphrase, a, std::string(password[0]).c_str());
   }
 
-  call(archive_read_set_read_callback, a, input_read);
-  call(archive_read_set_close_callback, a, input_close);
-  static auto isSeekable = cpp11::package("base")["isSeekable"];
-  if (isSeekable(connection)) {
-    call(archive_read_set_seek_callback, a, input_seek);
-  }
-  call(archive_read_set_callback_data, a, r.get());
-  call(archive_read_open1, a);
+  archive_read_open_input(a, r.get());
 
   ext = archive_write_disk_new();
   call(archive_write_disk_set_options, ext, flags);
@@ -146,16 +81,7 @@ static const char* strip_components(const char* p, int elements) {
   call(archive_write_disk_set_standard_lookup, ext);
 #endif
 
-  std::vector<R_xlen_t> file_indexes;
-  std::vector<std::string> file_names;
-
-  if (TYPEOF(file) == INTSXP) {
-    file_indexes = as_file_index(cpp11::integers(file));
-  } else if (TYPEOF(file) == REALSXP) {
-    file_indexes = as_file_index(cpp11::doubles(file));
-  } else if (TYPEOF(file) == STRSXP) {
-    file_names = cpp11::as_cpp<std::vector<std::string>>(file);
-  }
+  entry_selection selection(file);
 
   using namespace cpp11::literals;
 
@@ -181,9 +107,7 @@ static const char* strip_components(const char* p, int elements) {
       }
     }
 
-    if (file == R_NilValue ||
-        (!file_indexes.empty() && any_matches(index, file_indexes)) ||
-        (!file_names.empty() && any_matches(filename, file_names))) {
+    if (selection.matches(index, filename)) {
       extracted_files.push_back(filename);
 
       if (filename != original_filename) {
@@ -196,8 +120,7 @@ static const char* strip_components(const char* p, int elements) {
 
       num_extracted++;
 
-      if (num_extracted == file_indexes.size() ||
-          num_extracted == file_names.size()) {
+      if (selection.done(num_extracted)) {
         break;
       }
     }
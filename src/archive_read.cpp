@@ -1,5 +1,7 @@
 #include "r_archive.h"
 
+#include <unordered_map>
+
 /* Define BSWAP_32 on Big Endian systems */
 #ifdef WORDS_BIGENDIAN
 #if (defined(__sun) && defined(__SVR4))
@@ -62,6 +64,49 @@ int input_close(struct archive* a, void* client_data) {
   return (ARCHIVE_OK);
 }
 
+static bool use_mmap() {
+  static auto getOption = cpp11::package("base")["getOption"];
+  return cpp11::as_cpp<bool>(getOption("archive.mmap", false));
+}
+
+void archive_read_open_input(struct archive* a, input_data* data) {
+  /* The contents of an archive in a raw vector are read in place, `data`
+   * keeps the vector protected while it is read */
+  if (TYPEOF(data->connection) == RAWSXP) {
+    call(
+        archive_read_open_memory,
+        a,
+        static_cast<void*>(RAW(data->connection)),
+        (size_t)Rf_xlength(data->connection));
+    return;
+  }
+  if (TYPEOF(data->connection) == STRSXP) {
+    const char* path = CHAR(STRING_ELT(data->connection, 0));
+    /* Reads and seeks in a mapping need no system calls, repeated reads of
+     * the same archive share the mapping */
+    data->mapping = use_mmap() ? file_mapping::open(path) : nullptr;
+    if (data->mapping != nullptr) {
+      call(
+          archive_read_open_memory,
+          a,
+          const_cast<void*>(data->mapping->data()),
+          data->mapping->size());
+      return;
+    }
+    call(archive_read_open_filename, a, path, INPUT_FILE_BLOCK_SIZE);
+    return;
+  }
+
+  call(archive_read_set_read_callback, a, input_read);
+  call(archive_read_set_close_callback, a, input_close);
+  static auto isSeekable = cpp11::package("base")["isSeekable"];
+  if (isSeekable(data->connection)) {
+    call(archive_read_set_seek_callback, a, input_seek);
+  }
+  call(archive_read_set_callback_data, a, data);
+  call(archive_read_open1, a);
+}
+
 bool entry_matches(const std::string& str, archive_entry* entry) {
   if (str.empty()) {
     return false;
@@ -71,62 +116,189 @@ bool entry_matches(const std::string& str, archive_entry* entry) {
   return str == pathname;
 }
 
-static Rboolean rchive_read_open_impl(Rconnection con) {
-  rchive* r = (rchive*)con->private_ptr;
-
-  local_utf8_locale ll;
-
-  r->ar = archive_read_new();
-
-  bool is_raw_format = r->format == ARCHIVE_FORMAT_RAW;
-
-  con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
-
+void archive_read_support(
+    struct archive* a,
+    int format,
+    const int* filters,
+    const std::string& options,
+    const cpp11::strings& password) {
 /* explicit setting of the format and filters is not available until
  * libarchive version 3.1.0
  */
 #if ARCHIVE_VERSION_NUMBER >= 3001000
-  if (r->filters[0] == -1) {
-    call(archive_read_support_filter_all, con);
+  if (filters[0] == -1) {
+    call(archive_read_support_filter_all, a);
   } else {
-    for (int i = 0; i < FILTER_MAX && r->filters[i] != -1; ++i) {
-      call(archive_read_append_filter, con, r->filters[i]);
+    for (int i = 0; i < FILTER_MAX && filters[i] != -1; ++i) {
+      call(archive_read_append_filter, a, filters[i]);
     }
   }
 
-  if (r->format == -1) {
-    call(archive_read_support_format_all, con);
-  } else if (is_raw_format) {
-    call(archive_read_support_format_raw, con);
+  if (format == -1) {
+    call(archive_read_support_format_all, a);
+  } else if (format == ARCHIVE_FORMAT_RAW) {
+    call(archive_read_support_format_raw, a);
   } else {
-    call(archive_read_set_format, con, r->format);
+    call(archive_read_set_format, a, format);
   }
 #else
-  call(archive_read_support_filter_all, con);
-  call(archive_read_support_format_all, con);
+  call(archive_read_support_filter_all, a);
+  call(archive_read_support_format_all, a);
 #endif
+  archive_read_concatenated(a);
 
-  if (!r->options.empty()) {
-    call(archive_read_set_options, con, r->options.c_str());
+  if (!options.empty()) {
+    call(archive_read_set_options, a, options.c_str());
   }
 
-  if (!cpp11::is_na(r->password[0])) {
-    call(archive_read_add_passphrase, con, std::string(r->password[0]).c_str());
+  if (!cpp11::is_na(password[0])) {
+    call(archive_read_add_passphrase, a, std::string(password[0]).c_str());
   }
+}
 
-  static auto open = cpp11::package("base")["open"];
-  static auto isOpen = cpp11::package("base")["isOpen"];
-  if (!isOpen(r->input.connection)) {
-    open(r->input.connection, "rb");
+/* The format and the filters detected for archive files by their identity,
+ * the filters in the order they are appended and terminated by -1 */
+static std::unordered_map<std::string, std::vector<int>> detected_formats;
+
+/* The number of archive files whose format is remembered */
+static const size_t DETECTED_FORMATS_MAX = 1024;
+
+static std::string input_identity(const input_data& input) {
+  if (TYPEOF(input.connection) != STRSXP) {
+    return std::string();
   }
-  call(archive_read_set_read_callback, r->ar, input_read);
-  call(archive_read_set_close_callback, r->ar, input_close);
-  static auto isSeekable = cpp11::package("base")["isSeekable"];
-  if (isSeekable(r->input.connection)) {
-    call(archive_read_set_seek_callback, r->ar, input_seek);
+  return file_identity(CHAR(STRING_ELT(input.connection, 0)));
+}
+
+bool archive_read_support_input(
+    struct archive* a,
+    const input_data& input,
+    int format,
+    const int* filters,
+    const std::string& options,
+    const cpp11::strings& password) {
+  bool detect = false;
+  if (format == -1 && filters[0] == -1) {
+    std::string identity = input_identity(input);
+    auto it = detected_formats.find(identity);
+    if (it != detected_formats.end()) {
+      const std::vector<int>& detected = it->second;
+      archive_read_support(a, detected[0], &detected[1], options, password);
+      return false;
+    }
+    detect = !identity.empty();
   }
-  call(archive_read_set_callback_data, r->ar, &r->input);
-  call(archive_read_open1, r->ar);
+  archive_read_support(a, format, filters, options, password);
+  return detect;
+}
+
+void archive_read_remember_format(struct archive* a, const input_data& input) {
+#if ARCHIVE_VERSION_NUMBER >= 3001000
+  int format;
+  std::vector<int> filters;
+  archive_detect(a, format, filters);
+  if ((format & ARCHIVE_FORMAT_BASE_MASK) == 0 ||
+      format == ARCHIVE_FORMAT_EMPTY || filters.size() >= FILTER_MAX) {
+    return;
+  }
+  /* some formats which are detected can't be set explicitly */
+  struct archive* check = archive_read_new();
+  bool can_set = archive_read_set_format(check, format) == ARCHIVE_OK;
+  archive_read_free(check);
+  std::string identity = input_identity(input);
+  if (!can_set || identity.empty()) {
+    return;
+  }
+  if (detected_formats.size() >= DETECTED_FORMATS_MAX) {
+    detected_formats.clear();
+  }
+  /* archive_detect() lists the filters from the one closest to the format,
+   * they are appended starting from the one closest to the data */
+  std::vector<int>& detected = detected_formats[identity];
+  detected.assign(1, format);
+  detected.insert(detected.end(), filters.rbegin(), filters.rend());
+  detected.push_back(-1);
+#endif
+}
+
+/* The key of the entry read by `r` in the entry cache, configured by
+ * `options(archive.cache_size, archive.cache_dir, archive.cache_dir_size)`,
+ * or an empty string if the cache is off or the archive is not a file.
+ * Encrypted entries are never cached, so their contents are not available
+ * without the password, nor written to disk. */
+static std::string rchive_cache_key(rchive* r) {
+  static auto getOption = cpp11::package("base")["getOption"];
+  entry_cache& cache = entry_cache::instance();
+  double capacity = cpp11::as_cpp<double>(getOption("archive.cache_size", 0));
+  cache.configure(
+      capacity,
+      cpp11::as_cpp<std::string>(getOption("archive.cache_dir", "")),
+      cpp11::as_cpp<double>(getOption("archive.cache_dir_size", capacity)));
+  if (!cache.enabled() || TYPEOF(r->input.connection) != STRSXP ||
+      !cpp11::is_na(r->password[0])) {
+    return std::string();
+  }
+  std::string entry =
+      TYPEOF(r->file) == STRSXP
+          ? "name:" + cpp11::as_cpp<std::string>(r->file)
+          : "index:" + std::to_string(cpp11::as_cpp<int>(r->file));
+  std::string options = r->options + '\0' + std::to_string(r->format);
+  for (int i = 0; i < FILTER_MAX && r->filters[i] != -1; ++i) {
+    options += ',' + std::to_string(r->filters[i]);
+  }
+  return entry_cache_key(
+      CHAR(STRING_ELT(r->input.connection, 0)), entry, options);
+}
+
+/* Read the entry from its contents in memory */
+static void rchive_read_cached(rchive* r, entry_data data) {
+  r->cached = data;
+  r->cur = const_cast<char*>(data->data());
+  r->size = data->size();
+  r->has_more = 0;
+  r->last_response = ARCHIVE_EOF;
+}
+
+static Rboolean rchive_read_open_impl(Rconnection con) {
+  rchive* r = (rchive*)con->private_ptr;
+
+  local_utf8_locale ll;
+
+  con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+
+  if (r->cached != nullptr) {
+    /* reopened after reading from the cache */
+    r->cached = nullptr;
+    r->cur = nullptr;
+    r->size = 0;
+    r->last_response = 0;
+  }
+  std::string cache_key = rchive_cache_key(r);
+  if (!cache_key.empty()) {
+    entry_data data = entry_cache::instance().get(cache_key);
+    if (data != nullptr) {
+      rchive_read_cached(r, data);
+      con->isopen = TRUE;
+      return TRUE;
+    }
+  }
+
+  r->ar = archive_read_new();
+
+  bool is_raw_format = r->format == ARCHIVE_FORMAT_RAW;
+
+  bool detect = archive_read_support_input(
+      r->ar, r->input, r->format, r->filters, r->options, r->password);
+
+  if (TYPEOF(r->input.connection) != STRSXP &&
+      TYPEOF(r->input.connection) != RAWSXP) {
+    static auto open = cpp11::package("base")["open"];
+    static auto isOpen = cpp11::package("base")["isOpen"];
+    if (!isOpen(r->input.connection)) {
+      open(r->input.connection, "rb");
+    }
+  }
+  archive_read_open_input(r->ar, &r->input);
 
   /* Find entry to extract */
   int file_offset = -1;
@@ -141,9 +313,37 @@ static Rboolean rchive_read_open_impl(Rconnection con) {
   int itr = 0;
   int res;
   while ((res = archive_read_next_header(r->ar, &r->entry)) == ARCHIVE_OK) {
+    if (detect && itr == 0) {
+      archive_read_remember_format(r->ar, r->input);
+    }
     if (is_raw_format || entry_matches(file, r->entry) || itr == file_offset) {
       r->has_more = 1;
       con->isopen = TRUE;
+      /* An entry which fits in the cache is read whole and added to it */
+      if (!cache_key.empty() && archive_entry_size_is_set(r->entry) &&
+          (size_t)archive_entry_size(r->entry) <=
+              entry_cache::instance().capacity()) {
+        std::shared_ptr<std::vector<char>> data(new std::vector<char>);
+        data->reserve(archive_entry_size(r->entry));
+        const void* block;
+        size_t size;
+        int64_t offset;
+        while (call(archive_read_data_block, con, &block, &size, &offset) !=
+               ARCHIVE_EOF) {
+          const char* p = static_cast<const char*>(block);
+          data->insert(data->end(), p, p + size);
+        }
+        entry_cache::instance().put(cache_key, data);
+        rchive_read_cached(r, data);
+        return TRUE;
+      }
+      /* The worker must not call R, so only archives read natively (from a
+       * file, a mapping or a raw vector) are decoded ahead */
+      if (r->read_ahead_blocks > 0 &&
+          (TYPEOF(r->input.connection) == STRSXP ||
+           TYPEOF(r->input.connection) == RAWSXP)) {
+        start_read_ahead(r);
+      }
       push(r);
       return TRUE;
     }
@@ -163,6 +363,10 @@ static Rboolean rchive_read_open(Rconnection con) {
 
 void rchive_read_close(Rconnection con) {
   callback_unwind_protect([&] {
+    rchive* r = (rchive*)con->private_ptr;
+
+    /* stop decoding before the archive is closed */
+    r->read_ahead.reset();
     call(archive_read_close, con);
 
     con->isopen = FALSE;
@@ -175,6 +379,7 @@ void rchive_read_destroy(Rconnection con) {
     rchive* r = (rchive*)con->private_ptr;
 
     /* free the handle connection */
+    r->read_ahead.reset();
     call(archive_read_free, con);
 
     delete r;
@@ -182,7 +387,7 @@ void rchive_read_destroy(Rconnection con) {
 }
 
 /* Support for readBin() */
-static size_t rchive_read(void* target, size_t sz, size_t ni, Rconnection con) {
+size_t rchive_read(void* target, size_t sz, size_t ni, Rconnection con) {
   return callback_unwind_protect([&]() -> size_t {
     rchive* r = (rchive*)con->private_ptr;
     size_t size = sz * ni;
@@ -201,7 +406,7 @@ static size_t rchive_read(void* target, size_t sz, size_t ni, Rconnection con) {
 /* https://github.com/jeroen/curl/blob/102eb33288c853e0b3d4344fa1725388f606cecc/src/curl.c#L145
  */
 /* naive implementation of readLines */
-static int rchive_fgetc(Rconnection con) {
+int rchive_fgetc(Rconnection con) {
   int x = 0;
 #ifdef WORDS_BIGENDIAN
   return rchive_read(&x, 1, 1, con) ? BSWAP_32(x) : R_EOF;
@@ -210,6 +415,22 @@ static int rchive_fgetc(Rconnection con) {
 #endif
 }
 
+[[cpp11::register]] cpp11::list archive_cache_info_() {
+  using namespace cpp11::literals;
+  entry_cache& cache = entry_cache::instance();
+  return cpp11::writable::list(
+      {"hits"_nm = (double)cache.hits,
+       "disk_hits"_nm = (double)cache.disk_hits,
+       "misses"_nm = (double)cache.misses,
+       "entries"_nm = (double)cache.num_entries(),
+       "size"_nm = (double)cache.size(),
+       "capacity"_nm = (double)cache.capacity()});
+}
+
+[[cpp11::register]] void archive_cache_clear_() {
+  entry_cache::instance().clear();
+}
+
 [[cpp11::register]] SEXP archive_read_(
     const cpp11::sexp connection,
     const cpp11::sexp file,
@@ -219,6 +440,7 @@ static int rchive_fgetc(Rconnection con) {
     cpp11::integers filters,
     cpp11::strings options,
     cpp11::strings password,
+    size_t read_ahead = 0,
     size_t sz = 16384) {
   Rconnection con;
 
@@ -230,6 +452,7 @@ static int rchive_fgetc(Rconnection con) {
   r->buf.resize(sz);
   r->size = 0;
   r->cur = NULL;
+  r->read_ahead_blocks = read_ahead;
 
   r->input.connection = connection;
   r->input.buf.resize(sz);
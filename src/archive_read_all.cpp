@@ -0,0 +1,286 @@
+#include "r_archive.h"
+
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+/* An entry selected by archive_read_all(). Raw contents of a known size are
+ * read directly into the vector allocated for them, at `dest`. */
+struct selected_entry {
+  R_xlen_t index;
+  std::string path;
+  int64_t size;
+  char* dest = nullptr;
+};
+
+/* Read the rest of the current entry of `a` into `buf` */
+static void read_entry_data(struct archive* a, std::vector<char>& buf) {
+  const void* block;
+  size_t size;
+  int64_t offset;
+  int res;
+  while ((res = archive_read_data_block(a, &block, &size, &offset)) ==
+         ARCHIVE_OK) {
+    const char* p = static_cast<const char*>(block);
+    buf.insert(buf.end(), p, p + size);
+  }
+  if (res != ARCHIVE_EOF) {
+    const char* msg = archive_error_string(a);
+    throw std::runtime_error(msg ? msg : "unknown libarchive error");
+  }
+}
+
+/* Read the current entry of `a` into `dest`, which has room for the `size`
+ * bytes of the entry. Returns false if the entry is larger, then `buf` holds
+ * the first `size` + 1 bytes. */
+static bool read_entry_into(
+    struct archive* a, char* dest, int64_t size, std::vector<char>& buf) {
+  int64_t total = 0;
+  la_ssize_t n = 0;
+  while (total < size &&
+         (n = archive_read_data(a, dest + total, size - total)) > 0) {
+    total += n;
+  }
+  if (n < 0) {
+    const char* msg = archive_error_string(a);
+    throw std::runtime_error(msg ? msg : "unknown libarchive error");
+  }
+  char extra;
+  if (total == size && archive_read_data(a, &extra, 1) == 0) {
+    return true;
+  }
+  buf.assign(dest, dest + total);
+  if (total == size) {
+    buf.push_back(extra);
+  }
+  return false;
+}
+
+/* The readers of a zip archive used by each worker thread. The workers take
+ * entries in increasing order, so each reader only moves forward through the
+ * central directory. */
+class zip_readers {
+private:
+  struct reader {
+    struct archive* a = nullptr;
+    R_xlen_t index = 0;
+    ~reader() {
+      if (a != nullptr) {
+        archive_read_free(a);
+      }
+    }
+  };
+
+  std::string path_;
+  std::string options_;
+  const char* password_;
+  std::mutex mutex_;
+  std::map<std::thread::id, std::unique_ptr<reader>> readers_;
+
+  reader& get() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<reader>& r = readers_[std::this_thread::get_id()];
+    if (r == nullptr) {
+      r.reset(new reader);
+      r->a = archive_read_new();
+      archive_read_support_format_zip(r->a);
+      bool ok =
+          (options_.empty() ||
+           archive_read_set_options(r->a, options_.c_str()) >= ARCHIVE_WARN) &&
+          (password_ == nullptr ||
+           archive_read_add_passphrase(r->a, password_) == ARCHIVE_OK) &&
+          archive_read_open_filename(
+              r->a, path_.c_str(), INPUT_FILE_BLOCK_SIZE) == ARCHIVE_OK;
+      if (!ok) {
+        const char* msg = archive_error_string(r->a);
+        throw std::runtime_error(msg ? msg : "unknown libarchive error");
+      }
+    }
+    return *r;
+  }
+
+public:
+  zip_readers(
+      const std::string& path,
+      const std::string& options,
+      const char* password)
+      : path_(path), options_(options), password_(password) {}
+
+  /* Read `e` into its raw vector, or into `buf` */
+  void read(const selected_entry& e, std::vector<char>& buf) {
+    reader& r = get();
+    struct archive_entry* entry;
+    while (r.index < e.index) {
+      if (archive_read_next_header(r.a, &entry) < ARCHIVE_WARN) {
+        const char* msg = archive_error_string(r.a);
+        throw std::runtime_error(msg ? msg : "unknown libarchive error");
+      }
+      ++r.index;
+    }
+    if (e.dest == nullptr) {
+      buf.reserve(e.size > 0 ? e.size : 0);
+      read_entry_data(r.a, buf);
+    } else if (!read_entry_into(r.a, e.dest, e.size, buf)) {
+      throw std::runtime_error(
+          "The size of '" + e.path + "' does not match the zip directory");
+    }
+  }
+};
+
+static SEXP as_raw(const std::vector<char>& buf) {
+  SEXP out = Rf_allocVector(RAWSXP, buf.size());
+  if (!buf.empty()) {
+    memcpy(RAW(out), buf.data(), buf.size());
+  }
+  return out;
+}
+
+[[cpp11::register]] SEXP archive_read_all_(
+    const cpp11::sexp& connection,
+    cpp11::sexp file,
+    bool text,
+    cpp11::strings options,
+    cpp11::strings password,
+    int threads = 1) {
+  local_utf8_locale ll;
+
+  std::unique_ptr<input_data> r(new input_data);
+  r->buf.resize(16384);
+  r->connection = connection;
+
+  std::string read_options;
+  if (options.size() > 0) {
+    read_options = options[0];
+  }
+  std::string read_password;
+  if (!cpp11::is_na(password[0])) {
+    read_password = password[0];
+  }
+  const char* password_ptr =
+      cpp11::is_na(password[0]) ? nullptr : read_password.c_str();
+
+  struct archive* a = archive_read_new();
+  int all_filters[] = {-1};
+  bool detect = archive_read_support_input(
+      a, *r, -1, all_filters, read_options, password);
+  archive_read_open_input(a, r.get());
+
+  entry_selection selection(file);
+
+  /* The contents of the selected entries, in a list which keeps them
+   * protected */
+  cpp11::writable::list contents;
+  std::vector<selected_entry> entries;
+  std::vector<char> buf;
+
+  /* Members of zip archives given by filename are read on `threads` threads
+   * after the central directory has been read. Other archives are read in
+   * one pass, an entry at a time. */
+  bool parallel = false;
+
+  struct archive_entry* entry;
+  for (R_xlen_t index = 1;; ++index) {
+    int res = call(archive_read_next_header, a, &entry);
+    if (res == ARCHIVE_EOF) {
+      break;
+    }
+    if (index == 1) {
+      if (detect) {
+        archive_read_remember_format(a, *r);
+      }
+      parallel = threads > 1 && TYPEOF(connection) == STRSXP &&
+                 (archive_format(a) & ARCHIVE_FORMAT_BASE_MASK) ==
+                     ARCHIVE_FORMAT_ZIP;
+    }
+    const char* filename = archive_entry_pathname(entry);
+    if (filename == nullptr) {
+      filename = "";
+    }
+    if (archive_entry_filetype(entry) == AE_IFDIR ||
+        !selection.matches(index, filename)) {
+      continue;
+    }
+
+    selected_entry e;
+    e.index = index;
+    e.path = filename;
+    e.size = archive_entry_size_is_set(entry) ? archive_entry_size(entry) : -1;
+    /* An R error (e.g. the allocation for a corrupt size or a NUL in a
+     * string) is rethrown once `a` is freed */
+    try {
+      if (!text && e.size >= 0) {
+        cpp11::sexp raw(cpp11::safe[Rf_allocVector](RAWSXP, e.size));
+        e.dest = (char*)RAW(raw);
+        contents.push_back(raw);
+      } else {
+        contents.push_back(R_NilValue);
+      }
+
+      if (!parallel) {
+        buf.clear();
+        if (e.dest == nullptr || !read_entry_into(a, e.dest, e.size, buf)) {
+          buf.reserve(e.size > 0 ? e.size : 0);
+          read_entry_data(a, buf);
+          e.dest = nullptr;
+        }
+        if (e.dest == nullptr) {
+          cpp11::unwind_protect([&] {
+            contents[contents.size() - 1] =
+                text ? (SEXP)Rf_mkCharLenCE(buf.data(), buf.size(), CE_NATIVE)
+                     : as_raw(buf);
+          });
+        }
+      }
+    } catch (const std::exception&) {
+      archive_read_free(a);
+      throw;
+    }
+    entries.push_back(std::move(e));
+
+    if (selection.done(entries.size())) {
+      break;
+    }
+  }
+  call(archive_read_free, a);
+
+  if (parallel) {
+    zip_readers readers(
+        CHAR(STRING_ELT(connection, 0)), read_options, password_ptr);
+    ordered_workers<std::vector<char>> workers(
+        entries.size(),
+        threads,
+        threads * 4,
+        [&](size_t i, std::vector<char>& out) {
+          readers.read(entries[i], out);
+        });
+    for (size_t i = 0; i < entries.size(); ++i) {
+      /* An error is thrown after the workers are stopped */
+      std::vector<char> data = workers.take(i);
+      if (entries[i].dest == nullptr) {
+        /* Don't longjmp past the worker threads */
+        cpp11::unwind_protect([&] {
+          contents[i] =
+              text ? (SEXP)Rf_mkCharLenCE(data.data(), data.size(), CE_NATIVE)
+                   : as_raw(data);
+        });
+      }
+    }
+  }
+
+  cpp11::writable::strings names(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    names[i] = entries[i].path;
+  }
+
+  if (text) {
+    cpp11::writable::strings out(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      SET_STRING_ELT(out, i, contents[i]);
+    }
+    out.names() = names;
+    return out;
+  }
+  contents.names() = names;
+  return contents;
+}
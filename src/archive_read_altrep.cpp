@@ -0,0 +1,186 @@
+#include "r_archive.h"
+
+#include <R_ext/Altrep.h>
+#include <algorithm>
+
+/* An entry of an archive decoded on demand into a raw vector. The archive is
+ * left at the start of the entry's data, and freed once all of it has been
+ * decoded. */
+struct lazy_entry {
+  archive* a = nullptr;
+  input_data input;
+  R_xlen_t size = 0;
+  R_xlen_t decoded = 0;
+
+  ~lazy_entry() {
+    if (a != nullptr) {
+      archive_read_free(a);
+    }
+  }
+};
+
+/* The minimum to decode at a time, so element-wise access does not call
+ * libarchive for each byte */
+static const R_xlen_t LAZY_ENTRY_READ_SIZE = 64 * 1024;
+
+static R_altrep_class_t lazy_raw_class;
+
+static lazy_entry* lazy_entry_get(SEXP x) {
+  lazy_entry* e =
+      static_cast<lazy_entry*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+  if (e == nullptr) {
+    Rf_error("The archive entry is no longer available");
+  }
+  return e;
+}
+
+/* Decode the entry up to byte `upto` into the raw vector in data2, which is
+ * allocated for the whole entry on the first access */
+static void lazy_entry_decode(SEXP x, R_xlen_t upto) {
+  lazy_entry* e = lazy_entry_get(x);
+  SEXP data = R_altrep_data2(x);
+  if (data == R_NilValue) {
+    data = Rf_allocVector(RAWSXP, e->size);
+    R_set_altrep_data2(x, data);
+  }
+  Rbyte* p = RAW(data);
+  while (e->decoded < upto) {
+    R_xlen_t want = std::min(
+        std::max(upto - e->decoded, LAZY_ENTRY_READ_SIZE),
+        e->size - e->decoded);
+    la_ssize_t n = archive_read_data(e->a, p + e->decoded, want);
+    if (n < 0) {
+      const char* msg = archive_error_string(e->a);
+      Rf_error("%s", msg ? msg : "unknown libarchive error");
+    }
+    if (n == 0) {
+      Rf_error("The archive entry is shorter than its header");
+    }
+    e->decoded += n;
+  }
+  if (e->decoded == e->size && e->a != nullptr) {
+    archive_read_free(e->a);
+    e->a = nullptr;
+  }
+}
+
+static R_xlen_t lazy_raw_Length(SEXP x) { return lazy_entry_get(x)->size; }
+
+static Rboolean lazy_raw_Inspect(
+    SEXP x,
+    int pre,
+    int deep,
+    int pvec,
+    void (*inspect_subtree)(SEXP, int, int, int)) {
+  lazy_entry* e = lazy_entry_get(x);
+  Rprintf(
+      "archive_read_altrep (decoded %.0f of %.0f bytes)\n",
+      (double)e->decoded,
+      (double)e->size);
+  return TRUE;
+}
+
+static void* lazy_raw_Dataptr(SEXP x, Rboolean writeable) {
+  lazy_entry_decode(x, lazy_entry_get(x)->size);
+  return RAW(R_altrep_data2(x));
+}
+
+static const void* lazy_raw_Dataptr_or_null(SEXP x) {
+  lazy_entry* e = lazy_entry_get(x);
+  if (e->decoded < e->size || R_altrep_data2(x) == R_NilValue) {
+    return nullptr;
+  }
+  return RAW(R_altrep_data2(x));
+}
+
+static Rbyte lazy_raw_Elt(SEXP x, R_xlen_t i) {
+  lazy_entry_decode(x, i + 1);
+  return RAW(R_altrep_data2(x))[i];
+}
+
+static R_xlen_t
+lazy_raw_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte* buf) {
+  R_xlen_t size = lazy_entry_get(x)->size;
+  R_xlen_t end = std::min(i + n, size);
+  if (i >= end) {
+    return 0;
+  }
+  lazy_entry_decode(x, end);
+  memcpy(buf, RAW(R_altrep_data2(x)) + i, end - i);
+  return end - i;
+}
+
+[[cpp11::init]] void init_archive_altrep(DllInfo* dll) {
+  lazy_raw_class = R_make_altraw_class("archive_entry_raw", "archive", dll);
+  R_set_altrep_Length_method(lazy_raw_class, lazy_raw_Length);
+  R_set_altrep_Inspect_method(lazy_raw_class, lazy_raw_Inspect);
+  R_set_altvec_Dataptr_method(lazy_raw_class, lazy_raw_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(
+      lazy_raw_class, lazy_raw_Dataptr_or_null);
+  R_set_altraw_Elt_method(lazy_raw_class, lazy_raw_Elt);
+  R_set_altraw_Get_region_method(lazy_raw_class, lazy_raw_Get_region);
+}
+
+[[cpp11::register]] SEXP archive_read_altrep_(
+    const cpp11::sexp& connection,
+    cpp11::sexp file,
+    cpp11::strings options,
+    cpp11::strings password) {
+  local_utf8_locale ll;
+
+  std::unique_ptr<lazy_entry> e(new lazy_entry);
+  e->input.buf.resize(16384);
+  e->input.connection = connection;
+
+  std::string read_options;
+  if (options.size() > 0) {
+    read_options = options[0];
+  }
+
+  e->a = archive_read_new();
+  int all_filters[] = {-1};
+  bool detect = archive_read_support_input(
+      e->a, e->input, -1, all_filters, read_options, password);
+  archive_read_open_input(e->a, &e->input);
+
+  entry_selection selection(file);
+  struct archive_entry* entry;
+  bool found = false;
+  for (R_xlen_t index = 1; !found; ++index) {
+    if (call(archive_read_next_header, e->a, &entry) == ARCHIVE_EOF) {
+      break;
+    }
+    if (detect && index == 1) {
+      archive_read_remember_format(e->a, e->input);
+    }
+    const char* filename = archive_entry_pathname(entry);
+    found = selection.matches(index, filename ? filename : "");
+  }
+  if (!found) {
+    cpp11::stop("`file` not found in the archive");
+  }
+
+  /* Without a size in the header the length is not known until the entry has
+   * been decoded, so decode it now. Archives read from a connection are also
+   * decoded now, as decoding them calls R, which the ALTREP methods must not
+   * do through libarchive, and the connection may be closed by then. */
+  bool native_input = TYPEOF(connection) == STRSXP ||
+                      TYPEOF(connection) == RAWSXP;
+  if (!archive_entry_size_is_set(entry) || !native_input) {
+    std::vector<char> buf;
+    const void* block;
+    size_t size;
+    int64_t offset;
+    while (call(archive_read_data_block, e->a, &block, &size, &offset) !=
+           ARCHIVE_EOF) {
+      const char* p = static_cast<const char*>(block);
+      buf.insert(buf.end(), p, p + size);
+    }
+    cpp11::writable::raws out(buf.begin(), buf.end());
+    return out;
+  }
+
+  e->size = archive_entry_size(entry);
+  cpp11::external_pointer<lazy_entry> xp(e.release());
+  return R_new_altrep(lazy_raw_class, xp, R_NilValue);
+}
@@ -0,0 +1,174 @@
+#include "r_archive.h"
+
+#include <algorithm>
+
+/* Read up to `n` bytes of the current entry of `a` into `dest`, fewer only at
+ * the end of the entry */
+static size_t read_full(struct archive* a, char* dest, size_t n) {
+  size_t total = 0;
+  while (total < n) {
+    la_ssize_t res = archive_read_data(a, dest + total, n - total);
+    if (res < 0) {
+      const char* msg = archive_error_string(a);
+      cpp11::stop("%s", msg ? msg : "unknown libarchive error");
+    }
+    if (res == 0) {
+      break;
+    }
+    total += res;
+  }
+  return total;
+}
+
+/* The callback returns `FALSE` to stop reading */
+static bool is_false(SEXP x) {
+  return TYPEOF(x) == LGLSXP && Rf_xlength(x) == 1 && LOGICAL(x)[0] == FALSE;
+}
+
+/* Pass chunks of up to `chunk_size` bytes to `callback`. Each chunk is read
+ * straight into the raw vector passed to the callback, a new one each time as
+ * the callback may keep it. */
+static void read_raw_chunks(
+    struct archive* a,
+    struct archive_entry* entry,
+    const cpp11::function& callback,
+    size_t chunk_size) {
+  bool size_known = archive_entry_size_is_set(entry);
+  int64_t remaining = archive_entry_size(entry);
+  double pos = 1;
+  for (;;) {
+    size_t want = chunk_size;
+    if (size_known && remaining < (int64_t)want) {
+      /* at the end of the entry, check that there is no more data */
+      want = remaining > 0 ? remaining : 1;
+    }
+    cpp11::sexp chunk(cpp11::safe[Rf_allocVector](RAWSXP, want));
+    size_t n = read_full(a, (char*)RAW(chunk), want);
+    if (n == 0) {
+      break;
+    }
+    if (n < want) {
+      chunk = cpp11::safe[Rf_xlengthgets](chunk, n);
+    }
+    if (is_false(callback(chunk, pos))) {
+      break;
+    }
+    pos += n;
+    remaining -= n;
+  }
+}
+
+/* Pass the lines of chunks of about `chunk_size` bytes to `callback`. The
+ * data is read into one buffer, a line which does not end in it is moved to
+ * the front and completed by the next read. */
+static void read_line_chunks(
+    struct archive* a, const cpp11::function& callback, size_t chunk_size) {
+  std::vector<char> buf(chunk_size);
+  size_t have = 0;
+  double line = 1;
+  for (bool eof = false; !eof;) {
+    if (have == buf.size()) {
+      /* a line longer than the buffer */
+      buf.resize(buf.size() * 2);
+    }
+    size_t want = buf.size() - have;
+    size_t n = read_full(a, buf.data() + have, want);
+    eof = n < want;
+    have += n;
+
+    /* the chunk ends after the last complete line */
+    size_t end = have;
+    if (!eof) {
+      while (end > 0 && buf[end - 1] != '\n') {
+        --end;
+      }
+      if (end == 0) {
+        continue;
+      }
+    }
+    if (end == 0) {
+      break;
+    }
+
+    const char* start = buf.data();
+    const char* stop = buf.data() + end;
+    R_xlen_t num_lines = std::count(start, stop, '\n') + (stop[-1] != '\n');
+    cpp11::writable::strings lines(num_lines);
+    for (R_xlen_t i = 0; i < num_lines; ++i) {
+      const char* nl = std::find(start, stop, '\n');
+      const char* line_end = nl;
+      if (line_end > start && line_end[-1] == '\r') {
+        --line_end;
+      }
+      SET_STRING_ELT(
+          lines,
+          i,
+          cpp11::safe[Rf_mkCharLenCE](start, line_end - start, CE_NATIVE));
+      start = nl + 1;
+    }
+
+    if (is_false(callback(lines, line))) {
+      break;
+    }
+    line += lines.size();
+
+    memmove(buf.data(), buf.data() + end, have - end);
+    have -= end;
+  }
+}
+
+[[cpp11::register]] void archive_read_chunked_(
+    const cpp11::sexp& connection,
+    cpp11::sexp file,
+    cpp11::function callback,
+    size_t chunk_size,
+    bool lines,
+    cpp11::strings options,
+    cpp11::strings password) {
+  local_utf8_locale ll;
+
+  std::unique_ptr<input_data> r(new input_data);
+  r->buf.resize(16384);
+  r->connection = connection;
+
+  std::string read_options;
+  if (options.size() > 0) {
+    read_options = options[0];
+  }
+
+  /* The callback and the R API (through cpp11::safe) throw, and the longjmps
+   * of call() are turned into exceptions, so the archive is freed on every
+   * error */
+  std::unique_ptr<struct archive, int (*)(struct archive*)> a(
+      archive_read_new(), archive_read_free);
+
+  entry_selection selection(file);
+  struct archive_entry* entry;
+  bool found = false;
+  cpp11::unwind_protect([&] {
+    int all_filters[] = {-1};
+    bool detect = archive_read_support_input(
+        a.get(), *r, -1, all_filters, read_options, password);
+    archive_read_open_input(a.get(), r.get());
+
+    for (R_xlen_t index = 1; !found; ++index) {
+      if (call(archive_read_next_header, a.get(), &entry) == ARCHIVE_EOF) {
+        break;
+      }
+      if (detect && index == 1) {
+        archive_read_remember_format(a.get(), *r);
+      }
+      const char* filename = archive_entry_pathname(entry);
+      found = selection.matches(index, filename ? filename : "");
+    }
+  });
+  if (!found) {
+    cpp11::stop("`file` not found in the archive");
+  }
+
+  if (lines) {
+    read_line_chunks(a.get(), callback, chunk_size);
+  } else {
+    read_raw_chunks(a.get(), entry, callback, chunk_size);
+  }
+}
@@ -0,0 +1,82 @@
+#include "r_archive.h"
+#include "zip.h"
+#include <algorithm>
+#include <cerrno>
+#include <cli/progress.h>
+#include <cstring>
+
+const char* const pb_format =
+    "{cli::pb_spin} %zu copied | {cli::pb_current_bytes} "
+    "({cli::pb_rate_bytes}) | "
+    "{cli::pb_elapsed}";
+
+// Copy some members of a zip file to a new zip file. The local headers and
+// (compressed) data are copied verbatim, only the central directory is
+// rebuilt, so nothing is decompressed or recompressed.
+[[cpp11::register]] cpp11::strings archive_subset_(
+    const std::string& archive_filename,
+    const std::string& output_filename,
+    cpp11::sexp file,
+    size_t sz = 1048576) {
+
+  std::unique_ptr<FILE, int (*)(FILE*)> in(
+      fopen(archive_filename.c_str(), "rb"), fclose);
+  if (in == nullptr) {
+    cpp11::stop(
+        "Could not open '%s': %s", archive_filename.c_str(), strerror(errno));
+  }
+
+  zip_file_input input(in.get());
+
+  std::string comment;
+  std::vector<zip_entry> entries = zip_read_central_directory(input, comment);
+
+  /* Number the entries in the order they are stored, which is the order
+   * archive() lists them in */
+  std::stable_sort(
+      entries.begin(), entries.end(), [](const zip_entry& x, const zip_entry& y) {
+        return x.local_header_offset < y.local_header_offset;
+      });
+
+  entry_selection selection(file);
+
+  std::vector<char> buf(sz);
+
+  zip_writer out(output_filename);
+
+  cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
+
+  cpp11::writable::strings copied_files;
+  size_t num_copied = 0;
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    zip_entry entry = entries[i];
+    if (!selection.matches(i + 1, entry.name.c_str())) {
+      continue;
+    }
+
+    uint64_t size = zip_member_size(input, entry);
+    uint64_t offset = entry.local_header_offset;
+    entry.local_header_offset = out.offset();
+    out.copy(input, offset, size, buf);
+    out.add(entry);
+
+    copied_files.push_back(entry.name);
+    num_copied++;
+
+    if (CLI_SHOULD_TICK) {
+      cli_progress_set_format(progress_bar, pb_format, num_copied);
+      cli_progress_set(progress_bar, out.offset());
+    }
+
+    if (selection.done(num_copied)) {
+      break;
+    }
+  }
+
+  out.finish(comment);
+
+  cli_progress_done(progress_bar);
+
+  return copied_files;
+}
@@ -1,4 +1,5 @@
 #include "r_archive.h"
+#include "write_filters.h"
 #include <fcntl.h>
 #include <string.h>
 #include <vector>
@@ -12,20 +13,47 @@ std::string my_basename(std::string const& str) {
   return str.substr(found + 1);
 }
 
+void rchive_write_flush(Rconnection con) {
+  rchive* r = (rchive*)con->private_ptr;
+  if (!r->buf.empty()) {
+    call(archive_write_data, con, r->buf.data(), r->buf.size());
+    r->buf.clear();
+  }
+}
+
+void rchive_write_buffered(Rconnection con, const void* data, size_t n) {
+  rchive* r = (rchive*)con->private_ptr;
+  size_t capacity = r->buf.capacity();
+  if (r->buf.size() + n > capacity) {
+    rchive_write_flush(con);
+  }
+  /* Large writes bypass the buffer */
+  if (n >= capacity) {
+    call(archive_write_data, con, data, n);
+  } else {
+    const char* p = static_cast<const char*>(data);
+    r->buf.insert(r->buf.end(), p, p + n);
+  }
+  r->size += n;
+}
+
 /* callback function to store received data */
 static size_t
 rchive_write_data(const void* contents, size_t sz, size_t n, Rconnection ctx) {
   return callback_unwind_protect([&]() -> size_t {
-    rchive* r = (rchive*)ctx->private_ptr;
-
-    size_t realsize = sz * n;
-    call(archive_write_data, ctx, contents, realsize);
-    r->size += realsize;
+    rchive_write_buffered(ctx, contents, sz * n);
 
     return n;
   });
 }
 
+static int rchive_write_fflush(Rconnection con) {
+  return callback_unwind_protect([&] {
+    rchive_write_flush(con);
+    return 0;
+  });
+}
+
 std::string scratch_file(const char* filename) {
   static auto tempdir = cpp11::package("base")["tempdir"];
   std::string out =
@@ -71,6 +99,7 @@ void rchive_write_close_impl(Rconnection con) {
     return;
   }
   /* Close scratch file */
+  rchive_write_flush(con);
   call(archive_write_finish_entry, con);
   call(archive_write_close, con);
   call(archive_write_free, con);
@@ -105,19 +134,19 @@ void rchive_write_close_impl(Rconnection con) {
 
   call(archive_write_set_format, out, r->format);
 
+  std::vector<int> filters;
   for (int i = 0; i < FILTER_MAX && r->filters[i] != -1; ++i) {
-    call(archive_write_add_filter, out, r->filters[i]);
+    filters.push_back(r->filters[i]);
   }
+  parallel_filter pf = archive_write_add_filters(out, filters, r->threads, r->options);
 
   if (!cpp11::is_na(r->password[0])) {
     call(archive_write_set_passphrase, out, std::string(r->password[0]).c_str());
   }
 
-  if (!r->options.empty()) {
-    call(archive_write_set_options, out, r->options.c_str());
-  }
+  archive_write_set_filter_options(out, r->options, pf);
 
-  call(archive_write_open_filename, out, r->archive_filename.c_str());
+  archive_write_open_output(out, r->archive_filename, pf);
   call(archive_write_header, out, entry);
 
   while ((bytes_read = read(fd, buf, sizeof(buf))) > 0) {
@@ -156,6 +185,7 @@ void rchive_write_destroy(Rconnection con) {
     cpp11::integers filters,
     cpp11::strings options,
     cpp11::strings password,
+    int threads,
     size_t sz) {
   Rconnection con;
   SEXP rc =
@@ -168,6 +198,7 @@ void rchive_write_destroy(Rconnection con) {
 
   r->format = format;
   r->password = password;
+  r->threads = threads;
 
   // Initialize filters
   if (filters.size() > FILTER_MAX) {
@@ -186,6 +217,9 @@ void rchive_write_destroy(Rconnection con) {
     r->options = options[0];
   }
 
+  /* The size of the write buffer */
+  r->buf.reserve(sz);
+
   /* set connection properties */
   con->incomplete = TRUE;
   con->private_ptr = r;
@@ -199,6 +233,7 @@ void rchive_write_destroy(Rconnection con) {
   con->close = rchive_write_close;
   con->destroy = rchive_write_destroy;
   con->write = rchive_write_data;
+  con->fflush = rchive_write_fflush;
 
   UNPROTECT(1);
   return rc;
@@ -0,0 +1,261 @@
+#include "r_archive.h"
+#include "archive_write_files.h"
+#include "compressibility.h"
+#include "write_filters.h"
+#include <algorithm>
+#include <cerrno>
+#include <cli/progress.h>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Walks a directory tree in sorted order, calling `visit(path, st)` for each
+ * entry with its path relative to the top directory and its stat. Only the
+ * names of the directories being walked are held in memory. Like `dir()`,
+ * hidden files and directories are skipped and symbolic links are followed.
+ * Errors reading the directories are thrown as std::runtime_error, so the
+ * caller can clean up before they are raised. */
+class dir_walker {
+private:
+  std::string dir_;
+  bool recursive_;
+  std::unique_ptr<struct archive, int (*)(struct archive*)> include_;
+  std::unique_ptr<struct archive, int (*)(struct archive*)> exclude_;
+  std::unique_ptr<struct archive_entry, void (*)(struct archive_entry*)>
+      entry_;
+  bool has_include_ = false;
+  bool has_exclude_ = false;
+
+  static void add_patterns(
+      struct archive* m,
+      const cpp11::strings& patterns,
+      int (*add)(struct archive*, const char*)) {
+    for (auto pattern : patterns) {
+      if (add(m, std::string(pattern).c_str()) != ARCHIVE_OK) {
+        cpp11::stop(
+            "Invalid pattern '%s': %s",
+            std::string(pattern).c_str(),
+            archive_error_string(m));
+      }
+    }
+  }
+
+  bool allowed(struct archive* m, const std::string& path) {
+    archive_entry_copy_pathname(entry_.get(), path.c_str());
+    return archive_match_path_excluded(m, entry_.get()) == 0;
+  }
+
+  void walk(
+      const std::string& rel,
+      const std::function<void(const std::string&, const struct stat&)>&
+          visit) {
+    std::string path = rel.empty() ? dir_ : dir_ + "/" + rel;
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) {
+      throw std::runtime_error(
+          "Could not read '" + path + "': " + strerror(errno));
+    }
+    std::vector<std::string> names;
+    struct dirent* de;
+    while ((de = readdir(d)) != nullptr) {
+      if (de->d_name[0] != '.') {
+        names.push_back(de->d_name);
+      }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names) {
+      std::string child = rel.empty() ? name : rel + "/" + name;
+      if (has_exclude_ && !allowed(exclude_.get(), child)) {
+        continue;
+      }
+      struct stat st;
+      if (stat((dir_ + "/" + child).c_str(), &st) != 0) {
+        throw std::runtime_error(
+            "Could not read '" + child + "': " + strerror(errno));
+      }
+      if (S_ISDIR(st.st_mode) && recursive_) {
+        walk(child, visit);
+        continue;
+      }
+      if (has_include_ && !allowed(include_.get(), child)) {
+        continue;
+      }
+      visit(child, st);
+    }
+  }
+
+public:
+  dir_walker(
+      const std::string& dir,
+      bool recursive,
+      const cpp11::strings& include,
+      const cpp11::strings& exclude)
+      : dir_(dir),
+        recursive_(recursive),
+        include_(archive_match_new(), archive_match_free),
+        exclude_(archive_match_new(), archive_match_free),
+        entry_(archive_entry_new(), archive_entry_free) {
+    add_patterns(include_.get(), include, archive_match_include_pattern);
+    add_patterns(exclude_.get(), exclude, archive_match_exclude_pattern);
+    has_include_ = include.size() > 0;
+    has_exclude_ = exclude.size() > 0;
+  }
+
+  void walk(const std::function<void(const std::string&, const struct stat&)>&
+                visit) {
+    walk("", visit);
+  }
+};
+
+// Write the files in a directory to a new archive
+[[cpp11::register]] SEXP archive_write_dir_(
+    cpp11::sexp output,
+    const std::string& dir,
+    int format,
+    cpp11::integers filters,
+    cpp11::strings options,
+    cpp11::strings password,
+    cpp11::strings include,
+    cpp11::strings exclude,
+    bool recursive,
+    bool similar = false,
+    int threads = 1,
+    size_t sz = 16384) {
+
+  std::vector<int> filter_codes(filters.begin(), filters.end());
+  std::string write_options;
+  if (options.size() > 0) {
+    write_options = options[0];
+  }
+  std::string write_password;
+  if (!cpp11::is_na(password[0])) {
+    write_password = password[0];
+  }
+  const char* password_ptr =
+      cpp11::is_na(password[0]) ? nullptr : write_password.c_str();
+
+  dir_walker walker(dir, recursive, include, exclude);
+  archive_listing listing;
+
+  /* To reorder them all the entries are found before any are added */
+  std::vector<std::string> paths;
+  std::vector<struct stat> stats;
+  auto collect = [&](const std::string& path, const struct stat& st) {
+    paths.push_back(path);
+    stats.push_back(st);
+  };
+  auto walk_similar = [&](const std::function<void(
+                              const std::string&, const struct stat&)>& visit) {
+    walker.walk(collect);
+    std::vector<int64_t> sizes;
+    for (const struct stat& st : stats) {
+      sizes.push_back(st.st_size);
+    }
+    for (size_t i : similar_order(paths, sizes)) {
+      visit(paths[i], stats[i]);
+    }
+  };
+
+  if (archive_write_files_can_parallel(
+          output, format, filter_codes, threads)) {
+    std::vector<zip_member> members;
+    auto add = [&](const std::string& path, const struct stat& st) {
+      zip_member member;
+      member.name = path;
+      member.path = dir + "/" + path;
+      member.has_stat = true;
+      member.st = st;
+      members.push_back(std::move(member));
+    };
+    if (similar) {
+      walk_similar(add);
+    } else {
+      walker.walk(add);
+    }
+    archive_write_files_parallel(
+        output,
+        members,
+        write_options,
+        password_ptr,
+        threads,
+        listing);
+
+    return listing.as_tibble();
+  }
+
+  std::vector<char> buf(sz);
+
+  bool store_incompressible = zip_store_incompressible(format, write_options);
+
+  size_t num_written = 0;
+  size_t total_written = 0;
+
+  cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
+
+  struct archive* a = archive_write_files_open(
+      output,
+      format,
+      filter_codes,
+      write_options,
+      password_ptr,
+      threads);
+
+  /* Each entry is added as soon as it is found, using the stat from the
+   * walk */
+  auto add = [&](const std::string& path, const struct stat& st) {
+    prefetched_file file;
+    file.st = st;
+    if (S_ISREG(st.st_mode)) {
+      std::string full_path = dir + "/" + path;
+      file.fd = open(full_path.c_str(), O_RDONLY | O_BINARY);
+      if (file.fd == -1) {
+        throw std::runtime_error(
+            "Could not open '" + full_path + "': " + strerror(errno));
+      }
+      if (store_incompressible) {
+        read_head(full_path, file, COMPRESSIBILITY_PROBE_SIZE);
+      }
+    }
+    cpp11::unwind_protect([&] {
+      archive_write_file(
+          a,
+          path.c_str(),
+          file,
+          listing,
+          store_incompressible,
+          buf,
+          progress_bar,
+          num_written,
+          total_written);
+    });
+    ++num_written;
+  };
+  try {
+    if (similar) {
+      walk_similar(add);
+    } else {
+      walker.walk(add);
+    }
+    cpp11::unwind_protect([&] { call(archive_write_close, a); });
+  } catch (...) {
+    /* e.g. a file or directory which can't be read, don't leave the writer
+     * open and a partial archive behind */
+    archive_write_discard(a, output);
+    throw;
+  }
+  archive_write_free(a);
+
+  cli_progress_done(progress_bar);
+
+  return listing.as_tibble();
+}
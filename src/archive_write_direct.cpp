@@ -1,4 +1,5 @@
 #include "r_archive.h"
+#include "write_filters.h"
 #include <fcntl.h>
 #include <string.h>
 #include <vector>
@@ -7,16 +8,19 @@
 static size_t rchive_write_direct_data(
     const void* contents, size_t sz, size_t n, Rconnection con) {
   return callback_unwind_protect([&]() -> size_t {
-    rchive* r = (rchive*)con->private_ptr;
-
-    size_t realsize = sz * n;
-    call(archive_write_data, con, contents, realsize);
-    r->size += realsize;
+    rchive_write_buffered(con, contents, sz * n);
 
     return n;
   });
 }
 
+static int rchive_write_direct_fflush(Rconnection con) {
+  return callback_unwind_protect([&] {
+    rchive_write_flush(con);
+    return 0;
+  });
+}
+
 static Rboolean rchive_write_direct_open_impl(Rconnection con) {
   rchive* r = (rchive*)con->private_ptr;
 
@@ -24,9 +28,11 @@ static Rboolean rchive_write_direct_open_impl(Rconnection con) {
 
   r->ar = archive_write_new();
 
+  std::vector<int> filters;
   for (int i = 0; i < FILTER_MAX && r->filters[i] != -1; ++i) {
-    call(archive_write_add_filter, con, r->filters[i]);
+    filters.push_back(r->filters[i]);
   }
+  parallel_filter pf = archive_write_add_filters(r->ar, filters, r->threads, r->options);
 
   call(archive_write_set_format, con, r->format);
 
@@ -34,11 +40,9 @@ static Rboolean rchive_write_direct_open_impl(Rconnection con) {
     call(archive_write_set_passphrase, con, std::string(r->password[0]).c_str());
   }
 
-  if (!r->options.empty()) {
-    call(archive_write_set_options, con, r->options.c_str());
-  }
+  archive_write_set_filter_options(r->ar, r->options, pf);
 
-  call(archive_write_open_filename, con, r->archive_filename.c_str());
+  archive_write_open_output(r->ar, r->archive_filename, pf);
 
   r->entry = archive_entry_new();
 
@@ -69,6 +73,7 @@ void rchive_write_direct_close(Rconnection con) {
       return;
     }
     /* Close scratch file */
+    rchive_write_flush(con);
     call(archive_write_close, con);
     call(archive_write_free, con);
 
@@ -96,6 +101,7 @@ void rchive_write_direct_destroy(Rconnection con) {
     cpp11::integers filters,
     cpp11::strings options,
     cpp11::strings password,
+    int threads,
     size_t sz) {
   Rconnection con;
   SEXP rc =
@@ -119,6 +125,7 @@ void rchive_write_direct_destroy(Rconnection con) {
 
   r->format = format;
   r->password = password;
+  r->threads = threads;
 
   r->filename = std::move(filename);
 
@@ -126,6 +133,9 @@ void rchive_write_direct_destroy(Rconnection con) {
     r->options = options[0];
   }
 
+  /* The size of the write buffer */
+  r->buf.reserve(sz);
+
   /* set connection properties */
   con->incomplete = TRUE;
   con->private_ptr = r;
@@ -139,6 +149,7 @@ void rchive_write_direct_destroy(Rconnection con) {
   con->close = rchive_write_direct_close;
   con->destroy = rchive_write_direct_destroy;
   con->write = rchive_write_direct_data;
+  con->fflush = rchive_write_direct_fflush;
 
   UNPROTECT(1);
   return rc;
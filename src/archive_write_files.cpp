@@ -1,94 +1,284 @@
 #include "r_archive.h"
+#include "archive_write_files.h"
+#include "compressibility.h"
+#include "write_filters.h"
+#include <algorithm>
+#include <cerrno>
 #include <cli/progress.h>
-#include <fcntl.h>
-
-#ifndef O_BINARY
-#define O_BINARY 0
-#endif
+#include <cstring>
+#include <numeric>
+#include <tuple>
+#include <unistd.h>
 
 const char* const pb_format =
     "{cli::pb_spin} %zu added | {cli::pb_current_bytes} "
     "({cli::pb_rate_bytes}) | "
     "{cli::pb_elapsed}";
 
+struct archive* archive_write_files_open(
+    SEXP output,
+    int format,
+    const std::vector<int>& filters,
+    const std::string& options,
+    const char* password,
+    int threads) {
+  struct archive* a = archive_write_new();
+
+  call(archive_write_set_format, a, format);
+
+  parallel_filter pf = archive_write_add_filters(a, filters, threads, options);
+
+  archive_write_set_filter_options(a, options, pf);
+
+  if (password != nullptr) {
+    call(archive_write_set_passphrase, a, password);
+  }
+
+  archive_write_open_output(a, output, pf);
+
+  return a;
+}
+
+std::vector<size_t> similar_order(
+    const std::vector<std::string>& paths, const std::vector<int64_t>& sizes) {
+  std::vector<std::string> exts(paths.size());
+  std::vector<std::string> dirs(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    size_t slash = paths[i].find_last_of('/');
+    size_t dot = paths[i].find_last_of('.');
+    if (dot != std::string::npos &&
+        (slash == std::string::npos || dot > slash)) {
+      exts[i] = paths[i].substr(dot + 1);
+    }
+    if (slash != std::string::npos) {
+      dirs[i] = paths[i].substr(0, slash);
+    }
+  }
+
+  std::vector<size_t> order(paths.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+    return std::tie(exts[x], dirs[x], sizes[x]) <
+           std::tie(exts[y], dirs[y], sizes[y]);
+  });
+  return order;
+}
+
+bool archive_write_files_can_parallel(
+    SEXP output, int format, const std::vector<int>& filters, int threads) {
+  /* zip members are compressed independently, so can be compressed in
+   * parallel */
+  return threads > 1 && TYPEOF(output) == STRSXP && filters.empty() &&
+         (format & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_ZIP;
+}
+
+void archive_write_files_parallel(
+    SEXP output,
+    const std::vector<zip_member>& members,
+    const std::string& options,
+    const char* password,
+    int threads,
+    archive_listing& listing) {
+  cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
+  zip_write_parallel(
+      CHAR(STRING_ELT(output, 0)),
+      members,
+      options,
+      password,
+      threads,
+      [&](size_t i,
+          const std::string& name,
+          int64_t size,
+          time_t mtime,
+          uint64_t total_written) {
+        listing.add(name.c_str(), size, mtime);
+        size_t num_written = i + 1;
+        if (CLI_SHOULD_TICK) {
+          /* Don't longjmp past the worker threads */
+          cpp11::unwind_protect([&] {
+            cli_progress_set_format(progress_bar, pb_format, num_written);
+            cli_progress_set(progress_bar, total_written);
+          });
+        }
+      });
+  cli_progress_done(progress_bar);
+}
+
+void archive_write_file(
+    struct archive* a,
+    const char* name,
+    prefetched_file& file,
+    archive_listing& listing,
+    bool store_incompressible,
+    std::vector<char>& buf,
+    SEXP progress_bar,
+    size_t num_written,
+    size_t& total_written) {
+  struct archive_entry* entry = archive_entry_new();
+  entry_copy_stat(entry, &file.st);
+  archive_entry_set_pathname(entry, name);
+  if (store_incompressible) {
+    zip_set_member_compression(a, name, file.head.data(), file.head.size());
+  }
+  call(archive_write_header, a, entry);
+  /* tar, zip and 7zip store directories with a trailing '/', which
+   * archive() returns */
+  std::string path = name;
+  int base_format = archive_format(a) & ARCHIVE_FORMAT_BASE_MASK;
+  if (S_ISDIR(file.st.st_mode) &&
+      (base_format == ARCHIVE_FORMAT_TAR ||
+       base_format == ARCHIVE_FORMAT_ZIP ||
+       base_format == ARCHIVE_FORMAT_7ZIP) &&
+      (path.empty() || path.back() != '/')) {
+    path += '/';
+  }
+  listing.add(
+      path.c_str(),
+      S_ISREG(file.st.st_mode) ? (int64_t)file.st.st_size : 0,
+      file.st.st_mtime);
+
+  if (!file.head.empty()) {
+    call(archive_write_data, a, file.head.data(), file.head.size());
+    total_written += file.head.size();
+  }
+
+  if (file.fd != -1) {
+    ssize_t len;
+    while ((len = read(file.fd, buf.data(), buf.size())) > 0) {
+      call(archive_write_data, a, buf.data(), len);
+      total_written += len;
+      if (CLI_SHOULD_TICK) {
+        cli_progress_set_format(progress_bar, pb_format, num_written);
+
+        cli_progress_set(progress_bar, total_written);
+      }
+    }
+    if (len < 0) {
+      Rf_errorcall(
+          R_NilValue, "Could not read '%s': %s", name, strerror(errno));
+    }
+  }
+  archive_entry_free(entry);
+}
+
 // Write files already on disk to a new archive
 [[cpp11::register]] SEXP archive_write_files_(
-    const std::string& archive_filename,
+    cpp11::sexp output,
     cpp11::strings files,
     int format,
     cpp11::integers filters,
     cpp11::strings options,
     cpp11::strings password,
+    bool similar = false,
+    int threads = 1,
     size_t sz = 16384) {
 
-  struct archive* a;
-  struct archive_entry* entry;
-  struct stat st;
-  std::vector<char> buf;
-  int len;
-  int fd;
-
-  buf.resize(sz);
-
-  a = archive_write_new();
+  std::vector<int> filter_codes(filters.begin(), filters.end());
+  std::string write_options;
+  if (options.size() > 0) {
+    write_options = options[0];
+  }
+  std::string write_password;
+  if (!cpp11::is_na(password[0])) {
+    write_password = password[0];
+  }
+  const char* password_ptr =
+      cpp11::is_na(password[0]) ? nullptr : write_password.c_str();
 
-  call(archive_write_set_format, a, format);
+  std::vector<std::string> paths(files.begin(), files.end());
 
-  for (int i = 0; i < filters.size(); ++i) {
-    call(archive_write_add_filter, a, filters[i]);
+  /* Check all of the files before the output is created, so a missing file
+   * does not leave a partial archive */
+  for (const std::string& path : paths) {
+    if (access(path.c_str(), R_OK) != 0) {
+      cpp11::stop("Could not read '%s': %s", path.c_str(), strerror(errno));
+    }
   }
 
-  if (options.size() > 0) {
-    call(archive_write_set_options, a, std::string(options[0]).c_str());
+  if (similar) {
+    std::vector<int64_t> sizes(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      struct stat st;
+      sizes[i] = stat(paths[i].c_str(), &st) == 0 ? st.st_size : 0;
+    }
+    std::vector<std::string> sorted;
+    for (size_t i : similar_order(paths, sizes)) {
+      sorted.push_back(std::move(paths[i]));
+    }
+    paths.swap(sorted);
   }
 
-  if (!cpp11::is_na(password[0])) {
-    call(archive_write_set_passphrase, a, std::string(password[0]).c_str());
+  archive_listing listing;
+
+  if (archive_write_files_can_parallel(
+          output, format, filter_codes, threads)) {
+    std::vector<zip_member> members(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      members[i].path = paths[i];
+      members[i].name = members[i].path;
+    }
+    archive_write_files_parallel(
+        output,
+        members,
+        write_options,
+        password_ptr,
+        threads,
+        listing);
+
+    return listing.as_tibble();
   }
 
+  std::vector<char> buf(sz);
+
+  bool store_incompressible = zip_store_incompressible(format, write_options);
+
   size_t num_written = 0;
   size_t total_written = 0;
 
-  using namespace cpp11::literals;
-
   cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
 
-  call(archive_write_open_filename, a, archive_filename.c_str());
-  for (std::string file : files) {
-    stat(file.c_str(), &st);
-    entry = archive_entry_new();
-#if defined(_WIN32) || (!defined(__GNUC__) && !defined(__clang__))
-    // there are quite many CRT dialects and passing struct stat to 3rdparty library could be unstable.
-    archive_entry_set_size(entry, st.st_size);
-    archive_entry_set_mtime(entry, st.st_mtime, 0);
-    archive_entry_set_ctime(entry, st.st_ctime, 0);
-    archive_entry_set_atime(entry, st.st_atime, 0);
-    archive_entry_set_mode(entry, st.st_mode); // seems required as not defaulting to S_IFREG.
-#else
-    archive_entry_copy_stat(entry, &st);
-#endif
-    archive_entry_set_pathname(entry, file.c_str());
-    call(archive_write_header, a, entry);
-    if ((fd = open(file.c_str(), O_RDONLY|O_BINARY)) != -1) {
-      len = read(fd, buf.data(), buf.size());
-      while (len > 0) {
-        call(archive_write_data, a, buf.data(), len);
-        total_written += len;
-        if (CLI_SHOULD_TICK) {
-          cli_progress_set_format(progress_bar, pb_format, num_written);
+  struct archive* a = archive_write_files_open(
+      output,
+      format,
+      filter_codes,
+      write_options,
+      password_ptr,
+      threads);
 
-          cli_progress_set(progress_bar, total_written);
-        }
-        len = read(fd, buf.data(), buf.size());
-      }
-      close(fd);
+  /* Stat, open and start reading the next files while the current one is
+   * compressed */
+  file_prefetcher prefetcher(paths, sz);
+
+  try {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      prefetched_file file = prefetcher.take(i);
+      /* Turn the longjmp of an error into an exception, so the prefetcher's
+       * threads are stopped */
+      cpp11::unwind_protect([&] {
+        archive_write_file(
+            a,
+            paths[i].c_str(),
+            file,
+            listing,
+            store_incompressible,
+            buf,
+            progress_bar,
+            num_written,
+            total_written);
+      });
+      ++num_written;
     }
-    archive_entry_free(entry);
-    ++num_written;
+    cpp11::unwind_protect([&] { call(archive_write_close, a); });
+  } catch (...) {
+    /* e.g. a file which fails to read while it is written, don't leave the
+     * writer open and a partial archive behind */
+    archive_write_discard(a, output);
+    throw;
   }
-  call(archive_write_free, a);
+  archive_write_free(a);
 
   cli_progress_done(progress_bar);
 
-  return R_NilValue;
+  /* The listing of the new archive, without reading it back */
+  return listing.as_tibble();
 }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "file_prefetch.h"
+#include "zip_parallel.h"
+#include <archive.h>
+#include <cpp11/R.hpp>
+#include <string>
+#include <vector>
+
+struct archive_listing;
+
+/* Create a new archive with the given format and filters, written to
+ * `output`, a filename or an open R connection. `options` is empty and
+ * `password` is NULL if not given. */
+struct archive* archive_write_files_open(
+    SEXP output,
+    int format,
+    const std::vector<int>& filters,
+    const std::string& options,
+    const char* password,
+    int threads);
+
+/* Whether the members can be compressed in parallel by zip_write_parallel(),
+ * which writes to files only */
+bool archive_write_files_can_parallel(
+    SEXP output, int format, const std::vector<int>& filters, int threads);
+
+/* zip_write_parallel() to the file `output`, with a progress bar. The members
+ * written are added to `listing`. */
+void archive_write_files_parallel(
+    SEXP output,
+    const std::vector<zip_member>& members,
+    const std::string& options,
+    const char* password,
+    int threads,
+    archive_listing& listing);
+
+/* The order in which to add `paths` (of files with the given `sizes`) to
+ * put similar files next to each other, which helps solid formats: grouped
+ * by extension, then by directory, then by size */
+std::vector<size_t> similar_order(
+    const std::vector<std::string>& paths, const std::vector<int64_t>& sizes);
+
+/* Add the (prefetched) `file` to `a` as `name`, and to `listing`. With
+ * `store_incompressible` zip members which would not shrink are stored
+ * rather than deflated. libarchive and read errors
+ * longjmp, so callers with threads or locals with destructors should wrap
+ * this in cpp11::unwind_protect() */
+void archive_write_file(
+    struct archive* a,
+    const char* name,
+    prefetched_file& file,
+    archive_listing& listing,
+    bool store_incompressible,
+    std::vector<char>& buf,
+    SEXP progress_bar,
+    size_t num_written,
+    size_t& total_written);
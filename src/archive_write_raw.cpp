@@ -0,0 +1,129 @@
+#include "r_archive.h"
+#include "archive_write_files.h"
+#include "compressibility.h"
+#include "write_filters.h"
+#include <cli/progress.h>
+#include <ctime>
+
+const char* const pb_format =
+    "{cli::pb_spin} %zu added | {cli::pb_current_bytes} "
+    "({cli::pb_rate_bytes}) | "
+    "{cli::pb_elapsed}";
+
+/* Add `size` bytes of `data` to `a` as the regular file `name` */
+static void write_raw(
+    struct archive* a,
+    const char* name,
+    const char* data,
+    size_t size,
+    time_t mtime,
+    bool store_incompressible,
+    archive_listing& listing) {
+  struct archive_entry* entry = archive_entry_new();
+  archive_entry_set_filetype(entry, AE_IFREG);
+  archive_entry_set_perm(entry, 0644);
+  archive_entry_set_size(entry, size);
+  archive_entry_set_mtime(entry, mtime, 0);
+  archive_entry_set_pathname(entry, name);
+  if (store_incompressible) {
+    zip_set_member_compression(a, name, data, size);
+  }
+  call(archive_write_header, a, entry);
+  listing.add(name, size, mtime);
+  if (size > 0) {
+    call(archive_write_data, a, data, size);
+  }
+  archive_entry_free(entry);
+}
+
+// Write raw vectors to a new archive
+[[cpp11::register]] SEXP archive_write_raw_(
+    cpp11::sexp output,
+    cpp11::strings names,
+    cpp11::list contents,
+    int format,
+    cpp11::integers filters,
+    cpp11::strings options,
+    cpp11::strings password,
+    int threads = 1) {
+
+  std::vector<int> filter_codes(filters.begin(), filters.end());
+  std::string write_options;
+  if (options.size() > 0) {
+    write_options = options[0];
+  }
+  std::string write_password;
+  if (!cpp11::is_na(password[0])) {
+    write_password = password[0];
+  }
+  const char* password_ptr =
+      cpp11::is_na(password[0]) ? nullptr : write_password.c_str();
+
+  /* The data is used in place, the pointers are taken here as the R API can
+   * not be used by the worker threads */
+  std::vector<zip_member> members(contents.size());
+  for (R_xlen_t i = 0; i < contents.size(); ++i) {
+    SEXP x = contents[i];
+    members[i].name = names[i];
+    members[i].data = reinterpret_cast<const char*>(RAW(x));
+    members[i].size = Rf_xlength(x);
+  }
+
+  archive_listing listing;
+
+  if (archive_write_files_can_parallel(
+          output, format, filter_codes, threads)) {
+    archive_write_files_parallel(
+        output,
+        members,
+        write_options,
+        password_ptr,
+        threads,
+        listing);
+
+    return listing.as_tibble();
+  }
+
+  size_t total_written = 0;
+  time_t now = time(NULL);
+  bool store_incompressible = zip_store_incompressible(format, write_options);
+
+  cpp11::sexp progress_bar(cli_progress_bar(NA_INTEGER, R_NilValue));
+
+  struct archive* a = archive_write_files_open(
+      output,
+      format,
+      filter_codes,
+      write_options,
+      password_ptr,
+      threads);
+
+  try {
+    cpp11::unwind_protect([&] {
+      for (size_t i = 0; i < members.size(); ++i) {
+        write_raw(
+            a,
+            members[i].name.c_str(),
+            members[i].data,
+            members[i].size,
+            now,
+            store_incompressible,
+            listing);
+        total_written += members[i].size;
+        if (CLI_SHOULD_TICK) {
+          cli_progress_set_format(progress_bar, pb_format, i + 1);
+          cli_progress_set(progress_bar, total_written);
+        }
+      }
+      call(archive_write_close, a);
+    });
+  } catch (...) {
+    archive_write_discard(a, output);
+    throw;
+  }
+  archive_write_free(a);
+
+  cli_progress_done(progress_bar);
+
+  return listing.as_tibble();
+}
@@ -0,0 +1,81 @@
+#include "compressibility.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+/* Extensions of formats which are compressed already */
+static const char* const COMPRESSED_EXTENSIONS[] = {
+    "7z", "apk", "avi", "avif", "br", "bz2", "docx", "epub", "flac", "gif",
+    "gz", "heic", "jar", "jpeg", "jpg", "lz", "lz4", "lzma", "m4a", "m4v",
+    "mkv", "mov", "mp3", "mp4", "odp", "ods", "odt", "ogg", "opus", "parquet",
+    "png", "pptx", "rar", "rda", "rdata", "rds", "tgz", "txz", "webm", "webp",
+    "whl", "xlsx", "xz", "zip", "zst"};
+
+/* Below this the entropy estimate is too noisy to be useful */
+static const size_t MIN_PROBE_SIZE = 4096;
+
+/* In bits per byte, compressed or encrypted data is very close to 8 */
+static const double INCOMPRESSIBLE_ENTROPY = 7.9;
+
+static bool has_compressed_extension(const std::string& name) {
+  size_t dot = name.find_last_of('.');
+  size_t slash = name.find_last_of("/\\");
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    return false;
+  }
+  std::string ext = name.substr(dot + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {
+    return std::tolower(c);
+  });
+  for (const char* compressed : COMPRESSED_EXTENSIONS) {
+    if (ext == compressed) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* The Shannon entropy of the byte values, in bits per byte */
+static double byte_entropy(const unsigned char* data, size_t n) {
+  size_t counts[256] = {0};
+  for (size_t i = 0; i < n; ++i) {
+    ++counts[data[i]];
+  }
+  double entropy = 0;
+  for (size_t count : counts) {
+    if (count > 0) {
+      double p = (double)count / n;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy;
+}
+
+bool is_incompressible(const std::string& name, const char* head, size_t n) {
+  if (has_compressed_extension(name)) {
+    return true;
+  }
+  if (n < MIN_PROBE_SIZE) {
+    return false;
+  }
+  return byte_entropy(
+             reinterpret_cast<const unsigned char*>(head),
+             std::min(n, COMPRESSIBILITY_PROBE_SIZE)) > INCOMPRESSIBLE_ENTROPY;
+}
+
+bool zip_store_incompressible(int format, const std::string& options) {
+  return (format & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_ZIP &&
+         options.find("compression=") == std::string::npos;
+}
+
+void zip_set_member_compression(
+    struct archive* a, const std::string& name, const char* head, size_t n) {
+  /* These fail if libarchive was built without zlib, in which case members
+   * are always stored */
+  if (is_incompressible(name, head, n)) {
+    archive_write_zip_set_compression_store(a);
+  } else {
+    archive_write_zip_set_compression_deflate(a);
+  }
+}
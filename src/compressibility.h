@@ -0,0 +1,25 @@
+#pragma once
+
+#include <archive.h>
+#include <cstddef>
+#include <string>
+
+/* Whether a file named `name` which starts with the `n` bytes of `head` is
+ * unlikely to shrink when compressed, either because its extension is that
+ * of an already compressed format (e.g. .jpg, .zip, .parquet) or because
+ * the bytes of `head` are close to random. */
+bool is_incompressible(const std::string& name, const char* head, size_t n);
+
+/* Whether the compression method of each member of an archive of `format`
+ * written with `options` should be chosen by is_incompressible(). This is
+ * the case for zip archives, unless the options set the compression
+ * explicitly. */
+bool zip_store_incompressible(int format, const std::string& options);
+
+/* Store the next member of the zip archive `a` if it is incompressible,
+ * otherwise deflate it */
+void zip_set_member_compression(
+    struct archive* a, const std::string& name, const char* head, size_t n);
+
+/* The amount of data to read to decide with is_incompressible() */
+static const size_t COMPRESSIBILITY_PROBE_SIZE = 64 * 1024;
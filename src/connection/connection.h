@@ -29,6 +29,8 @@ SEXP new_connection(
 
 size_t read_connection(SEXP connection, void* buf, size_t n);
 
+size_t write_connection(SEXP connection, const void* buf, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
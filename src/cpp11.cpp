@@ -5,6 +5,35 @@
 #include "cpp11/declarations.hpp"
 #include <R_ext/Visibility.h>
 
+// archive_concat.cpp
+void archive_concat_(cpp11::strings archive_filenames, const std::string& output_filename, size_t sz);
+extern "C" SEXP _archive_archive_concat_(SEXP archive_filenames, SEXP output_filename, SEXP sz) {
+  BEGIN_CPP11
+    archive_concat_(cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(archive_filenames), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(output_filename), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz));
+    return R_NilValue;
+  END_CPP11
+}
+// archive_convert.cpp
+cpp11::strings archive_convert_(const cpp11::sexp& connection, cpp11::sexp output, int format, cpp11::integers filters, cpp11::sexp file, int num_strip_components, cpp11::strings read_options, cpp11::strings options, cpp11::strings password, int threads, size_t sz);
+extern "C" SEXP _archive_archive_convert_(SEXP connection, SEXP output, SEXP format, SEXP filters, SEXP file, SEXP num_strip_components, SEXP read_options, SEXP options, SEXP password, SEXP threads, SEXP sz) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_convert_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp&>>(connection), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(output), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<int>>(num_strip_components), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(read_options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+  END_CPP11
+}
+// archive_entries.cpp
+SEXP archive_entries_(const cpp11::sexp connection, const std::string& description, const std::string& mode, cpp11::integers format, cpp11::integers filters, cpp11::strings options, cpp11::strings password);
+extern "C" SEXP _archive_archive_entries_(SEXP connection, SEXP description, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_entries_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp>>(connection), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(description), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(mode), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password)));
+  END_CPP11
+}
+// archive_entries.cpp
+SEXP archive_next_(SEXP entries);
+extern "C" SEXP _archive_archive_next_(SEXP entries) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_next_(cpp11::as_cpp<cpp11::decay_t<SEXP>>(entries)));
+  END_CPP11
+}
 // archive_extract.cpp
 cpp11::strings archive_extract_(const cpp11::sexp& connection, cpp11::sexp file, int num_strip_components, cpp11::strings options, cpp11::strings password, size_t sz);
 extern "C" SEXP _archive_archive_extract_(SEXP connection, SEXP file, SEXP num_strip_components, SEXP options, SEXP password, SEXP sz) {
@@ -13,31 +42,89 @@ extern "C" SEXP _archive_archive_extract_(SEXP connection, SEXP file, SEXP num_s
   END_CPP11
 }
 // archive_read.cpp
-SEXP archive_read_(const cpp11::sexp connection, const cpp11::sexp file, const std::string& description, const std::string& mode, cpp11::integers format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, size_t sz);
-extern "C" SEXP _archive_archive_read_(SEXP connection, SEXP file, SEXP description, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP sz) {
+cpp11::list archive_cache_info_();
+extern "C" SEXP _archive_archive_cache_info_() {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_cache_info_());
+  END_CPP11
+}
+// archive_read.cpp
+void archive_cache_clear_();
+extern "C" SEXP _archive_archive_cache_clear_() {
   BEGIN_CPP11
-    return cpp11::as_sexp(archive_read_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp>>(connection), cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(description), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(mode), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+    archive_cache_clear_();
+    return R_NilValue;
+  END_CPP11
+}
+// archive_read.cpp
+SEXP archive_read_(const cpp11::sexp connection, const cpp11::sexp file, const std::string& description, const std::string& mode, cpp11::integers format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, size_t read_ahead, size_t sz);
+extern "C" SEXP _archive_archive_read_(SEXP connection, SEXP file, SEXP description, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP read_ahead, SEXP sz) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_read_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp>>(connection), cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(description), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(mode), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<size_t>>(read_ahead), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+  END_CPP11
+}
+// archive_read_all.cpp
+SEXP archive_read_all_(const cpp11::sexp& connection, cpp11::sexp file, bool text, cpp11::strings options, cpp11::strings password, int threads);
+extern "C" SEXP _archive_archive_read_all_(SEXP connection, SEXP file, SEXP text, SEXP options, SEXP password, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_read_all_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp&>>(connection), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<bool>>(text), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// archive_read_altrep.cpp
+SEXP archive_read_altrep_(const cpp11::sexp& connection, cpp11::sexp file, cpp11::strings options, cpp11::strings password);
+extern "C" SEXP _archive_archive_read_altrep_(SEXP connection, SEXP file, SEXP options, SEXP password) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_read_altrep_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp&>>(connection), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password)));
+  END_CPP11
+}
+// archive_read_chunked.cpp
+void archive_read_chunked_(const cpp11::sexp& connection, cpp11::sexp file, cpp11::function callback, size_t chunk_size, bool lines, cpp11::strings options, cpp11::strings password);
+extern "C" SEXP _archive_archive_read_chunked_(SEXP connection, SEXP file, SEXP callback, SEXP chunk_size, SEXP lines, SEXP options, SEXP password) {
+  BEGIN_CPP11
+    archive_read_chunked_(cpp11::as_cpp<cpp11::decay_t<const cpp11::sexp&>>(connection), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<cpp11::function>>(callback), cpp11::as_cpp<cpp11::decay_t<size_t>>(chunk_size), cpp11::as_cpp<cpp11::decay_t<bool>>(lines), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password));
+    return R_NilValue;
+  END_CPP11
+}
+// archive_subset.cpp
+cpp11::strings archive_subset_(const std::string& archive_filename, const std::string& output_filename, cpp11::sexp file, size_t sz);
+extern "C" SEXP _archive_archive_subset_(SEXP archive_filename, SEXP output_filename, SEXP file, SEXP sz) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_subset_(cpp11::as_cpp<cpp11::decay_t<const std::string&>>(archive_filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(output_filename), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(file), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+  END_CPP11
+}
+// archive_write_dir.cpp
+SEXP archive_write_dir_(cpp11::sexp output, const std::string& dir, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, cpp11::strings include, cpp11::strings exclude, bool recursive, bool similar, int threads, size_t sz);
+extern "C" SEXP _archive_archive_write_dir_(SEXP output, SEXP dir, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP include, SEXP exclude, SEXP recursive, SEXP similar, SEXP threads, SEXP sz) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_write_dir_(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(output), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(dir), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(include), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(exclude), cpp11::as_cpp<cpp11::decay_t<bool>>(recursive), cpp11::as_cpp<cpp11::decay_t<bool>>(similar), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
   END_CPP11
 }
 // archive_write_direct.cpp
-SEXP archive_write_direct_(const std::string& archive_filename, const std::string& filename, std::string mode, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, size_t sz);
-extern "C" SEXP _archive_archive_write_direct_(SEXP archive_filename, SEXP filename, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP sz) {
+SEXP archive_write_direct_(const std::string& archive_filename, const std::string& filename, std::string mode, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, int threads, size_t sz);
+extern "C" SEXP _archive_archive_write_direct_(SEXP archive_filename, SEXP filename, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP threads, SEXP sz) {
   BEGIN_CPP11
-    return cpp11::as_sexp(archive_write_direct_(cpp11::as_cpp<cpp11::decay_t<const std::string&>>(archive_filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(filename), cpp11::as_cpp<cpp11::decay_t<std::string>>(mode), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+    return cpp11::as_sexp(archive_write_direct_(cpp11::as_cpp<cpp11::decay_t<const std::string&>>(archive_filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(filename), cpp11::as_cpp<cpp11::decay_t<std::string>>(mode), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
   END_CPP11
 }
 // archive_write_files.cpp
-SEXP archive_write_files_(const std::string& archive_filename, cpp11::strings files, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, size_t sz);
-extern "C" SEXP _archive_archive_write_files_(SEXP archive_filename, SEXP files, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP sz) {
+SEXP archive_write_files_(cpp11::sexp output, cpp11::strings files, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, bool similar, int threads, size_t sz);
+extern "C" SEXP _archive_archive_write_files_(SEXP output, SEXP files, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP similar, SEXP threads, SEXP sz) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(archive_write_files_(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(output), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(files), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<bool>>(similar), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+  END_CPP11
+}
+// archive_write_raw.cpp
+SEXP archive_write_raw_(cpp11::sexp output, cpp11::strings names, cpp11::list contents, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, int threads);
+extern "C" SEXP _archive_archive_write_raw_(SEXP output, SEXP names, SEXP contents, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP threads) {
   BEGIN_CPP11
-    return cpp11::as_sexp(archive_write_files_(cpp11::as_cpp<cpp11::decay_t<const std::string&>>(archive_filename), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(files), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+    return cpp11::as_sexp(archive_write_raw_(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(output), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(names), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(contents), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
   END_CPP11
 }
 // archive_write.cpp
-SEXP archive_write_(const std::string& archive_filename, const std::string& filename, const std::string& mode, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, size_t sz);
-extern "C" SEXP _archive_archive_write_(SEXP archive_filename, SEXP filename, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP sz) {
+SEXP archive_write_(const std::string& archive_filename, const std::string& filename, const std::string& mode, int format, cpp11::integers filters, cpp11::strings options, cpp11::strings password, int threads, size_t sz);
+extern "C" SEXP _archive_archive_write_(SEXP archive_filename, SEXP filename, SEXP mode, SEXP format, SEXP filters, SEXP options, SEXP password, SEXP threads, SEXP sz) {
   BEGIN_CPP11
-    return cpp11::as_sexp(archive_write_(cpp11::as_cpp<cpp11::decay_t<const std::string&>>(archive_filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(mode), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
+    return cpp11::as_sexp(archive_write_(cpp11::as_cpp<cpp11::decay_t<const std::string&>>(archive_filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(filename), cpp11::as_cpp<cpp11::decay_t<const std::string&>>(mode), cpp11::as_cpp<cpp11::decay_t<int>>(format), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(filters), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(options), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(password), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<size_t>>(sz)));
   END_CPP11
 }
 // archive.cpp
@@ -104,10 +191,10 @@ extern "C" SEXP _archive_libarchive_libzstd_version() {
   END_CPP11
 }
 // r_archive.h
-void rchive_init(SEXP nc_xptr, SEXP rc_xptr);
-extern "C" SEXP _archive_rchive_init(SEXP nc_xptr, SEXP rc_xptr) {
+void rchive_init(SEXP nc_xptr, SEXP rc_xptr, SEXP wc_xptr);
+extern "C" SEXP _archive_rchive_init(SEXP nc_xptr, SEXP rc_xptr, SEXP wc_xptr) {
   BEGIN_CPP11
-    rchive_init(cpp11::as_cpp<cpp11::decay_t<SEXP>>(nc_xptr), cpp11::as_cpp<cpp11::decay_t<SEXP>>(rc_xptr));
+    rchive_init(cpp11::as_cpp<cpp11::decay_t<SEXP>>(nc_xptr), cpp11::as_cpp<cpp11::decay_t<SEXP>>(rc_xptr), cpp11::as_cpp<cpp11::decay_t<SEXP>>(wc_xptr));
     return R_NilValue;
   END_CPP11
 }
@@ -115,26 +202,40 @@ extern "C" SEXP _archive_rchive_init(SEXP nc_xptr, SEXP rc_xptr) {
 extern "C" {
 static const R_CallMethodDef CallEntries[] = {
     {"_archive_archive_",                    (DL_FUNC) &_archive_archive_,                    3},
+    {"_archive_archive_cache_clear_",        (DL_FUNC) &_archive_archive_cache_clear_,        0},
+    {"_archive_archive_cache_info_",         (DL_FUNC) &_archive_archive_cache_info_,         0},
+    {"_archive_archive_concat_",             (DL_FUNC) &_archive_archive_concat_,             3},
+    {"_archive_archive_convert_",            (DL_FUNC) &_archive_archive_convert_,            11},
+    {"_archive_archive_entries_",            (DL_FUNC) &_archive_archive_entries_,            7},
     {"_archive_archive_extract_",            (DL_FUNC) &_archive_archive_extract_,            6},
     {"_archive_archive_filters",             (DL_FUNC) &_archive_archive_filters,             0},
     {"_archive_archive_formats",             (DL_FUNC) &_archive_archive_formats,             0},
-    {"_archive_archive_read_",               (DL_FUNC) &_archive_archive_read_,               9},
-    {"_archive_archive_write_",              (DL_FUNC) &_archive_archive_write_,              8},
-    {"_archive_archive_write_direct_",       (DL_FUNC) &_archive_archive_write_direct_,       8},
-    {"_archive_archive_write_files_",        (DL_FUNC) &_archive_archive_write_files_,        7},
+    {"_archive_archive_next_",               (DL_FUNC) &_archive_archive_next_,               1},
+    {"_archive_archive_read_",               (DL_FUNC) &_archive_archive_read_,               10},
+    {"_archive_archive_read_all_",           (DL_FUNC) &_archive_archive_read_all_,           6},
+    {"_archive_archive_read_altrep_",        (DL_FUNC) &_archive_archive_read_altrep_,        4},
+    {"_archive_archive_read_chunked_",       (DL_FUNC) &_archive_archive_read_chunked_,       7},
+    {"_archive_archive_subset_",             (DL_FUNC) &_archive_archive_subset_,             4},
+    {"_archive_archive_write_",              (DL_FUNC) &_archive_archive_write_,              9},
+    {"_archive_archive_write_dir_",          (DL_FUNC) &_archive_archive_write_dir_,          12},
+    {"_archive_archive_write_direct_",       (DL_FUNC) &_archive_archive_write_direct_,       9},
+    {"_archive_archive_write_files_",        (DL_FUNC) &_archive_archive_write_files_,        9},
+    {"_archive_archive_write_raw_",          (DL_FUNC) &_archive_archive_write_raw_,          8},
     {"_archive_libarchive_bzlib_version_",   (DL_FUNC) &_archive_libarchive_bzlib_version_,   0},
     {"_archive_libarchive_liblz4_version_",  (DL_FUNC) &_archive_libarchive_liblz4_version_,  0},
     {"_archive_libarchive_liblzma_version_", (DL_FUNC) &_archive_libarchive_liblzma_version_, 0},
     {"_archive_libarchive_libzstd_version",  (DL_FUNC) &_archive_libarchive_libzstd_version,  0},
     {"_archive_libarchive_version_",         (DL_FUNC) &_archive_libarchive_version_,         0},
     {"_archive_libarchive_zlib_version_",    (DL_FUNC) &_archive_libarchive_zlib_version_,    0},
-    {"_archive_rchive_init",                 (DL_FUNC) &_archive_rchive_init,                 2},
+    {"_archive_rchive_init",                 (DL_FUNC) &_archive_rchive_init,                 3},
     {NULL, NULL, 0}
 };
 }
 
+void init_archive_altrep(DllInfo* dll);
 extern "C" attribute_visible void R_init_archive(DllInfo* dll){
   R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
+  init_archive_altrep(dll);
   R_forceSymbols(dll, TRUE);
 }
@@ -0,0 +1,222 @@
+#include "entry_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <functional>
+#include <sys/stat.h>
+#include <utime.h>
+
+entry_cache& entry_cache::instance() {
+  static entry_cache cache;
+  return cache;
+}
+
+void entry_cache::configure(
+    size_t capacity, const std::string& dir, size_t dir_capacity) {
+  capacity_ = capacity;
+  dir_ = dir;
+  dir_capacity_ = dir_capacity;
+  evict();
+}
+
+void entry_cache::evict() {
+  while (size_ > capacity_ && !items_.empty()) {
+    size_ -= items_.back().second->size();
+    index_.erase(items_.back().first);
+    items_.pop_back();
+  }
+}
+
+entry_data entry_cache::get(const std::string& key) {
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    /* move to the front, as the most recently used */
+    items_.splice(items_.begin(), items_, it->second);
+    ++hits;
+    return it->second->second;
+  }
+  entry_data data = read_disk(key);
+  if (data != nullptr) {
+    ++disk_hits;
+    insert(key, data);
+    return data;
+  }
+  ++misses;
+  return nullptr;
+}
+
+void entry_cache::put(const std::string& key, entry_data data) {
+  write_disk(key, *data);
+  insert(key, data);
+}
+
+void entry_cache::insert(const std::string& key, entry_data data) {
+  if (data->size() > capacity_) {
+    return;
+  }
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    size_ -= it->second->second->size();
+    items_.erase(it->second);
+    index_.erase(it);
+  }
+  items_.emplace_front(key, data);
+  index_[key] = items_.begin();
+  size_ += data->size();
+  evict();
+}
+
+void entry_cache::clear() {
+  items_.clear();
+  index_.clear();
+  size_ = 0;
+  hits = disk_hits = misses = 0;
+}
+
+/* Files in the disk tier are named by the hash of the key, and start with
+ * the key itself to detect collisions */
+static const size_t DISK_NAME_LENGTH = 16;
+
+std::string entry_cache::disk_path(const std::string& key) const {
+  char name[32];
+  snprintf(
+      name,
+      sizeof(name),
+      "%016llx",
+      (unsigned long long)std::hash<std::string>()(key));
+  return dir_ + "/" + name;
+}
+
+entry_data entry_cache::read_disk(const std::string& key) const {
+  if (dir_.empty()) {
+    return nullptr;
+  }
+  FILE* f = fopen(disk_path(key).c_str(), "rb");
+  if (f == nullptr) {
+    return nullptr;
+  }
+  std::shared_ptr<std::vector<char>> data;
+  std::vector<char> file_key(key.size() + 1);
+  if (fread(file_key.data(), 1, file_key.size(), f) == file_key.size() &&
+      std::string(file_key.data(), key.size()) == key &&
+      file_key.back() == '\n') {
+    data = std::make_shared<std::vector<char>>();
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      data->insert(data->end(), buf, buf + n);
+    }
+    if (ferror(f)) {
+      data = nullptr;
+    }
+  }
+  fclose(f);
+  if (data != nullptr) {
+    /* mark the file as recently used */
+    utime(disk_path(key).c_str(), nullptr);
+  }
+  return data;
+}
+
+void entry_cache::write_disk(
+    const std::string& key, const std::vector<char>& data) const {
+  if (dir_.empty()) {
+    return;
+  }
+  /* write to a temporary file first, so readers never see a partial file */
+  std::string path = disk_path(key);
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == nullptr) {
+    return;
+  }
+  bool ok = fwrite(key.data(), 1, key.size(), f) == key.size() &&
+            fputc('\n', f) != EOF &&
+            fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return;
+  }
+  trim_disk();
+}
+
+/* Remove the least recently used files of the disk tier until the others
+ * fit in `dir_capacity_` bytes */
+void entry_cache::trim_disk() const {
+  DIR* d = opendir(dir_.c_str());
+  if (d == nullptr) {
+    return;
+  }
+  struct disk_file {
+    time_t mtime;
+    size_t size;
+    std::string path;
+  };
+  std::vector<disk_file> files;
+  size_t total = 0;
+  struct dirent* de;
+  while ((de = readdir(d)) != nullptr) {
+    /* only the files named by disk_path() */
+    if (strlen(de->d_name) != DISK_NAME_LENGTH ||
+        strspn(de->d_name, "0123456789abcdef") != DISK_NAME_LENGTH) {
+      continue;
+    }
+    std::string path = dir_ + "/" + de->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+      files.push_back({st.st_mtime, (size_t)st.st_size, path});
+      total += st.st_size;
+    }
+  }
+  closedir(d);
+  if (total <= dir_capacity_) {
+    return;
+  }
+  std::sort(
+      files.begin(), files.end(), [](const disk_file& x, const disk_file& y) {
+        return x.mtime < y.mtime;
+      });
+  for (const disk_file& file : files) {
+    if (total <= dir_capacity_) {
+      break;
+    }
+    if (remove(file.path.c_str()) == 0) {
+      total -= file.size;
+    }
+  }
+}
+
+std::string file_identity(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return std::string();
+  }
+  std::string key = path;
+  key += '\0';
+  key += std::to_string((long long)st.st_size);
+  key += '\0';
+  key += std::to_string((long long)st.st_mtime);
+#if defined(__APPLE__)
+  key += '.' + std::to_string((long)st.st_mtimespec.tv_nsec);
+#elif !defined(_WIN32)
+  key += '.' + std::to_string((long)st.st_mtim.tv_nsec);
+#endif
+  return key;
+}
+
+std::string entry_cache_key(
+    const std::string& path,
+    const std::string& entry,
+    const std::string& options) {
+  std::string key = file_identity(path);
+  if (key.empty()) {
+    return key;
+  }
+  key += '\0';
+  key += options;
+  key += '\0';
+  key += entry;
+  return key;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef std::shared_ptr<const std::vector<char>> entry_data;
+
+/* A cache of the decoded contents of archive entries, by a key which
+ * identifies the archive file (its path, size and modification time) and the
+ * entry. The least recently used entries are evicted to keep the cached
+ * contents within `capacity` bytes. With a directory set, entries are also
+ * written there, and read back when they are not in memory; the least
+ * recently used files are removed to keep the directory within
+ * `dir_capacity` bytes. Must only be used from the main thread. */
+class entry_cache {
+private:
+  typedef std::pair<std::string, entry_data> item;
+
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+  std::string dir_;
+  size_t dir_capacity_ = 0;
+  std::list<item> items_;
+  std::unordered_map<std::string, std::list<item>::iterator> index_;
+
+  void evict();
+  void insert(const std::string& key, entry_data data);
+  std::string disk_path(const std::string& key) const;
+  entry_data read_disk(const std::string& key) const;
+  void write_disk(const std::string& key, const std::vector<char>& data) const;
+  void trim_disk() const;
+
+public:
+  size_t hits = 0;
+  size_t disk_hits = 0;
+  size_t misses = 0;
+
+  /* Set the memory limit in bytes (0 disables the cache), the directory of
+   * the disk tier (empty for none) and its limit in bytes */
+  void configure(
+      size_t capacity, const std::string& dir, size_t dir_capacity);
+  bool enabled() const { return capacity_ > 0; }
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return size_; }
+  size_t num_entries() const { return items_.size(); }
+
+  /* The cached contents for `key`, or nullptr */
+  entry_data get(const std::string& key);
+  void put(const std::string& key, entry_data data);
+  void clear();
+
+  static entry_cache& instance();
+};
+
+/* The identity of the file at `path`, its path, size and modification time
+ * (in nanoseconds where available), or an empty string if it can't be
+ * stat()ed */
+std::string file_identity(const std::string& path);
+
+/* The cache key of the entry `entry` (e.g. a name or a position) of the
+ * archive file at `path`, or an empty string if it can't be stat()ed */
+std::string entry_cache_key(
+    const std::string& path,
+    const std::string& entry,
+    const std::string& options);
@@ -0,0 +1,69 @@
+#include "file_mapping.h"
+#include <fcntl.h>
+#include <map>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/* The mappings in use, by path */
+static std::map<std::string, std::weak_ptr<file_mapping>> mappings;
+
+static bool same_file(const struct stat& x, const struct stat& y) {
+  return x.st_dev == y.st_dev && x.st_ino == y.st_ino &&
+         x.st_size == y.st_size && x.st_mtime == y.st_mtime;
+}
+
+file_mapping::file_mapping(
+    const std::string& path, const struct stat& st, void* data)
+    : path_(path), st_(st), data_(data), size_(st.st_size) {}
+
+file_mapping::~file_mapping() {
+#ifndef _WIN32
+  munmap(data_, size_);
+#endif
+  auto it = mappings.find(path_);
+  if (it != mappings.end() && it->second.expired()) {
+    mappings.erase(it);
+  }
+}
+
+std::shared_ptr<file_mapping> file_mapping::open(const std::string& path) {
+#ifdef _WIN32
+  return nullptr;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size == 0) {
+    return nullptr;
+  }
+
+  auto it = mappings.find(path);
+  if (it != mappings.end()) {
+    std::shared_ptr<file_mapping> mapping = it->second.lock();
+    if (mapping != nullptr && same_file(mapping->st_, st)) {
+      return mapping;
+    }
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return nullptr;
+  }
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  /* Most archives are read from start to end, start reading it in now */
+#if defined(MADV_SEQUENTIAL) && defined(MADV_WILLNEED)
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  madvise(data, st.st_size, MADV_WILLNEED);
+#endif
+
+  std::shared_ptr<file_mapping> mapping(new file_mapping(path, st, data));
+  mappings[path] = mapping;
+  return mapping;
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+/* A read only memory mapping of a whole file. Readers of the same, unchanged
+ * file share one mapping, which is unmapped when the last of them is done. */
+class file_mapping {
+private:
+  std::string path_;
+  struct stat st_;
+  void* data_;
+  size_t size_;
+
+  file_mapping(const std::string& path, const struct stat& st, void* data);
+
+public:
+  file_mapping(const file_mapping&) = delete;
+  file_mapping& operator=(const file_mapping&) = delete;
+  ~file_mapping();
+
+  const void* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  /* The mapping of `path`, or nullptr if it can not be mapped, e.g. because
+   * it is empty or not a regular file, or memory mapping is not supported.
+   * Must be called from the main thread. */
+  static std::shared_ptr<file_mapping> open(const std::string& path);
+};
@@ -0,0 +1,88 @@
+#include "file_prefetch.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* The number of I/O threads and how many files they may be ahead */
+static const int PREFETCH_THREADS = 4;
+static const size_t PREFETCH_WINDOW = 16;
+
+prefetched_file::prefetched_file(prefetched_file&& x) noexcept
+    : st(x.st), fd(x.fd), head(std::move(x.head)) {
+  x.fd = -1;
+}
+
+prefetched_file& prefetched_file::operator=(prefetched_file&& x) noexcept {
+  if (this != &x) {
+    if (fd != -1) {
+      close(fd);
+    }
+    st = x.st;
+    fd = x.fd;
+    head = std::move(x.head);
+    x.fd = -1;
+  }
+  return *this;
+}
+
+prefetched_file::~prefetched_file() {
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+file_prefetcher::file_prefetcher(
+    std::vector<std::string> paths, size_t head_size)
+    : paths_(std::move(paths)),
+      head_size_(head_size),
+      workers_(
+          paths_.size(),
+          PREFETCH_THREADS,
+          PREFETCH_WINDOW,
+          [this](size_t i, prefetched_file& file) { prefetch(i, file); }) {}
+
+/* Runs on the I/O threads, so must not call the R API */
+void file_prefetcher::prefetch(size_t i, prefetched_file& file) {
+  const std::string& path = paths_[i];
+  if (stat(path.c_str(), &file.st) != 0) {
+    throw std::runtime_error(
+        "Could not read '" + path + "': " + strerror(errno));
+  }
+  if (!S_ISREG(file.st.st_mode)) {
+    return;
+  }
+
+  file.fd = open(path.c_str(), O_RDONLY | O_BINARY);
+  if (file.fd == -1) {
+    throw std::runtime_error(
+        "Could not open '" + path + "': " + strerror(errno));
+  }
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  read_head(path, file, head_size_);
+}
+
+void read_head(const std::string& path, prefetched_file& file, size_t size) {
+  file.head.resize(size);
+  size_t n = 0;
+  while (n < size) {
+    ssize_t len = read(file.fd, file.head.data() + n, size - n);
+    if (len < 0) {
+      throw std::runtime_error(
+          "Could not read '" + path + "': " + strerror(errno));
+    }
+    if (len == 0) {
+      break;
+    }
+    n += len;
+  }
+  file.head.resize(n);
+}
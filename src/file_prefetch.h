@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ordered_workers.h"
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+/* A file which has been stat()ed, opened (if it is a regular file) and whose
+ * first bytes have been read, by a file_prefetcher */
+struct prefetched_file {
+  struct stat st;
+  int fd = -1;
+  std::vector<char> head;
+
+  prefetched_file() = default;
+  prefetched_file(const prefetched_file&) = delete;
+  prefetched_file& operator=(const prefetched_file&) = delete;
+  prefetched_file(prefetched_file&& x) noexcept;
+  prefetched_file& operator=(prefetched_file&& x) noexcept;
+  ~prefetched_file();
+};
+
+/* Read up to `size` bytes from the (open) `file` into its head, errors are
+ * thrown as std::runtime_error */
+void read_head(const std::string& path, prefetched_file& file, size_t size);
+
+/* Stats, opens and reads the start of `paths` on a small pool of I/O
+ * threads, ahead of the main thread which takes the files in order. This
+ * hides the per file latency of network file systems. Errors, e.g. for
+ * missing files, are thrown by `take()` as std::runtime_error. */
+class file_prefetcher {
+private:
+  std::vector<std::string> paths_;
+  size_t head_size_;
+  ordered_workers<prefetched_file> workers_;
+
+  void prefetch(size_t i, prefetched_file& file);
+
+public:
+  file_prefetcher(std::vector<std::string> paths, size_t head_size);
+  prefetched_file take(size_t i) { return workers_.take(i); }
+};
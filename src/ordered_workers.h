@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A pool of threads running `work(i, result)` for i in [0, n), whose results
+ * are taken in order by the main thread. The workers run at most `window`
+ * items ahead of the main thread, to bound the memory (and open files etc.)
+ * used by results which have not been taken yet.
+ *
+ * `work` runs on the worker threads, so must not call the R API. Exceptions
+ * thrown by it are rethrown by `take()` on the main thread. */
+template <typename T> class ordered_workers {
+private:
+  struct item {
+    T result;
+    std::exception_ptr error;
+  };
+
+  size_t n_;
+  size_t window_;
+  std::function<void(size_t, T&)> work_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  size_t next_ = 0;
+  size_t consumed_ = 0;
+  bool cancelled_ = false;
+  std::map<size_t, item> done_;
+
+  std::vector<std::thread> threads_;
+
+  void run() {
+    for (;;) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [&] {
+        return cancelled_ || next_ >= n_ || next_ < consumed_ + window_;
+      });
+      if (cancelled_ || next_ >= n_) {
+        return;
+      }
+      size_t i = next_++;
+      lock.unlock();
+
+      item it;
+      try {
+        work_(i, it.result);
+      } catch (...) {
+        it.error = std::current_exception();
+      }
+
+      lock.lock();
+      done_[i] = std::move(it);
+      done_cv_.notify_all();
+    }
+  }
+
+public:
+  ordered_workers(
+      size_t n,
+      int threads,
+      size_t window,
+      std::function<void(size_t, T&)> work)
+      : n_(n), window_(window), work_(std::move(work)) {
+    for (int i = 0; i < threads && (size_t)i < n; ++i) {
+      threads_.emplace_back(&ordered_workers::run, this);
+    }
+  }
+
+  ~ordered_workers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cancelled_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread& t : threads_) {
+      t.join();
+    }
+  }
+
+  /* Wait for the result of item `i`, items must be taken in order */
+  T take(size_t i) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return done_.count(i) > 0; });
+    item it = std::move(done_[i]);
+    done_.erase(i);
+    ++consumed_;
+    work_cv_.notify_all();
+    lock.unlock();
+
+    if (it.error) {
+      std::rethrow_exception(it.error);
+    }
+    return std::move(it.result);
+  }
+};
@@ -4,11 +4,15 @@ SEXP new_connection_xptr;
 
 SEXP read_connection_xptr;
 
-void rchive_init(SEXP nc_xptr, SEXP rc_xptr) {
+SEXP write_connection_xptr;
+
+void rchive_init(SEXP nc_xptr, SEXP rc_xptr, SEXP wc_xptr) {
   new_connection_xptr = nc_xptr;
   R_PreserveObject(nc_xptr);
   read_connection_xptr = rc_xptr;
   R_PreserveObject(rc_xptr);
+  write_connection_xptr = wc_xptr;
+  R_PreserveObject(wc_xptr);
 }
 
 SEXP new_connection(
@@ -22,12 +26,123 @@ SEXP new_connection(
   return new_connection_ptr(description, mode, class_name, ptr);
 }
 
+static SEXP pending_unwind = nullptr;
+
+void set_pending_unwind(SEXP token) { pending_unwind = token; }
+
+SEXP take_pending_unwind() {
+  SEXP token = pending_unwind;
+  pending_unwind = nullptr;
+  return token;
+}
+
 size_t read_connection(SEXP connection, void* buf, size_t n) {
   auto read_connection_ptr = reinterpret_cast<size_t (*)(SEXP, void*, size_t)>(
       R_ExternalPtrAddr(read_connection_xptr));
   return read_connection_ptr(connection, buf, n);
 }
 
+size_t write_connection(SEXP connection, const void* buf, size_t n) {
+  auto write_connection_ptr =
+      reinterpret_cast<size_t (*)(SEXP, const void*, size_t)>(
+          R_ExternalPtrAddr(write_connection_xptr));
+  return write_connection_ptr(connection, buf, n);
+}
+
+template <typename C>
+static std::vector<R_xlen_t> as_file_index(const C& in) {
+  std::vector<R_xlen_t> out;
+  out.reserve(in.size());
+  for (R_xlen_t value : in) {
+    out.push_back(value);
+  }
+  return out;
+}
+
+template <typename T, typename C>
+static bool any_matches(const T& needle, const std::vector<C>& haystack) {
+  for (const C& n : haystack) {
+    if (n == needle) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void entry_copy_stat(struct archive_entry* entry, const struct stat* st) {
+#if defined(_WIN32) || (!defined(__GNUC__) && !defined(__clang__))
+  // there are quite many CRT dialects and passing struct stat to 3rdparty library could be unstable.
+  archive_entry_set_size(entry, st->st_size);
+  archive_entry_set_mtime(entry, st->st_mtime, 0);
+  archive_entry_set_ctime(entry, st->st_ctime, 0);
+  archive_entry_set_atime(entry, st->st_atime, 0);
+  archive_entry_set_mode(entry, st->st_mode); // seems required as not defaulting to S_IFREG.
+#else
+  archive_entry_copy_stat(entry, st);
+#endif
+}
+
+/* From
+https://github.com/libarchive/libarchive/blob/0fd2ed25d78e9f4505de5dcb6208c6c0ff8d2edb/tar/util.c#L338-L375
+*/
+const char* strip_components(const char* p, int elements) {
+  /* Skip as many elements as necessary. */
+  while (elements > 0) {
+    switch (*p++) {
+    case '/':
+#if defined(_WIN32)
+    case '\\': /* Support \ path sep on Windows ONLY. */
+#endif
+      elements--;
+      break;
+    case '\0':
+      /* Path is too short, skip it. */
+      return (NULL);
+    }
+  }
+
+  /* Skip any / characters.  This handles short paths that have
+   * additional / termination.  This also handles the case where
+   * the logic above stops in the middle of a duplicate //
+   * sequence (which would otherwise get converted to an
+   * absolute path). */
+  for (;;) {
+    switch (*p) {
+    case '/':
+#if defined(_WIN32)
+    case '\\': /* Support \ path sep on Windows ONLY. */
+#endif
+      ++p;
+      break;
+    case '\0':
+      return (NULL);
+    default:
+      return (p);
+    }
+  }
+}
+
+entry_selection::entry_selection(const cpp11::sexp& file)
+    : all_(file == R_NilValue) {
+  if (TYPEOF(file) == INTSXP) {
+    indexes_ = as_file_index(cpp11::integers(file));
+  } else if (TYPEOF(file) == REALSXP) {
+    indexes_ = as_file_index(cpp11::doubles(file));
+  } else if (TYPEOF(file) == STRSXP) {
+    names_ = cpp11::as_cpp<std::vector<std::string>>(file);
+  }
+}
+
+bool entry_selection::matches(R_xlen_t index, const char* filename) const {
+  return all_ || (!indexes_.empty() && any_matches(index, indexes_)) ||
+         (!names_.empty() && any_matches(filename, names_));
+}
+
+bool entry_selection::done(size_t num_selected) const {
+  return !all_ &&
+         (num_selected == indexes_.size() || num_selected == names_.size());
+}
+
 size_t pop(void* target, size_t max, rchive* r) {
   size_t copy_size = r->size < max ? r->size : max;
   memcpy(target, r->cur, copy_size);
@@ -41,6 +156,39 @@ size_t pop(void* target, size_t max, rchive* r) {
   return copy_size;
 }
 
+void start_read_ahead(rchive* r) {
+  struct archive* a = r->ar;
+  bool eof = false;
+  /* There is one worker, so the blocks are decoded in order. It runs at most
+   * `read_ahead_blocks` ahead of the reader. */
+  r->next_block = 0;
+  r->read_ahead.reset(new ordered_workers<read_block>(
+      SIZE_MAX,
+      1,
+      r->read_ahead_blocks,
+      [a, eof](size_t, read_block& block) mutable {
+        if (eof) {
+          block.eof = true;
+          return;
+        }
+        const void* buf;
+        size_t size;
+        __LA_INT64_T offset;
+        int response = archive_read_data_block(a, &buf, &size, &offset);
+        if (response == ARCHIVE_EOF) {
+          eof = block.eof = true;
+          return;
+        }
+        if (response != ARCHIVE_OK) {
+          eof = true;
+          const char* msg = archive_error_string(a);
+          throw std::runtime_error(msg ? msg : "unknown libarchive error");
+        }
+        const char* p = static_cast<const char*>(buf);
+        block.data.assign(p, p + size);
+      }));
+}
+
 size_t push(rchive* r) {
   R_CheckUserInterrupt();
   const void* buf;
@@ -58,14 +206,32 @@ size_t push(rchive* r) {
   /* move existing data to front of buffer (if any) */
   memmove(r->buf.data(), r->cur, r->size);
 
-  /* read data from archive */
-  r->last_response = archive_read_data_block(r->ar, &buf, &size, &offset);
-  if (r->last_response == ARCHIVE_EOF) {
+  /* the archive of an entry from archive_next() has moved on to the next */
+  if (r->cursor && r->cursor->index != r->cursor_index) {
     r->has_more = 0;
     return 0;
   }
-  if (r->last_response != ARCHIVE_OK) {
-    Rf_error("%s", archive_error_string(r->ar));
+
+  /* read data from archive, or from the read-ahead thread */
+  read_block block;
+  if (r->read_ahead) {
+    block = r->read_ahead->take(r->next_block++);
+    if (block.eof) {
+      r->last_response = ARCHIVE_EOF;
+      r->has_more = 0;
+      return 0;
+    }
+    buf = block.data.data();
+    size = block.data.size();
+  } else {
+    r->last_response = archive_read_data_block(r->ar, &buf, &size, &offset);
+    if (r->last_response == ARCHIVE_EOF) {
+      r->has_more = 0;
+      return 0;
+    }
+    if (r->last_response != ARCHIVE_OK) {
+      Rf_error("%s", archive_error_string(r->ar));
+    }
   }
 
   /* allocate more space if required */
@@ -1,6 +1,9 @@
 #include <cpp11.hpp>
 
 #include "connection/connection.h"
+#include "entry_cache.h"
+#include "file_mapping.h"
+#include "ordered_workers.h"
 
 #undef Realloc
 // Also need to undefine the Free macro
@@ -14,6 +17,8 @@
 #include <R_ext/Boolean.h>
 
 #include <clocale>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -21,9 +26,42 @@
 
 #define FILTER_MAX 8
 
+/* The size of the reads from archives opened by filename. libarchive seeks
+ * in these natively, so e.g. reading a zip's central directory needs no
+ * calls to R. */
+static const size_t INPUT_FILE_BLOCK_SIZE = 256 * 1024;
+
 struct input_data {
   cpp11::sexp connection;
   std::vector<char> buf;
+  /* the mapping of the archive, if it is read from memory */
+  std::shared_ptr<file_mapping> mapping;
+};
+
+/* An archive opened by archive_entries(), whose entries are read in turn by
+ * the connections returned by archive_next() */
+struct archive_cursor {
+  archive* ar = nullptr;
+  input_data input;
+  std::string description;
+  std::string mode;
+  /* the 1-based index of the current entry, 0 before the first */
+  size_t index = 0;
+  bool done = false;
+  /* remember the format of the archive after the first header */
+  bool detect = false;
+
+  ~archive_cursor() {
+    if (ar != nullptr) {
+      archive_read_free(ar);
+    }
+  }
+};
+
+/* A block of an entry decoded by the read-ahead thread */
+struct read_block {
+  std::vector<char> data;
+  bool eof = false;
 };
 
 struct rchive {
@@ -40,19 +78,118 @@ struct rchive {
   bool has_more = true;
   size_t size = 0;
   int filters[FILTER_MAX];
+  int threads = 1;
   std::string options;
   cpp11::strings password;
+  /* the number of blocks to decode ahead on another thread, and the thread */
+  size_t read_ahead_blocks = 0;
+  std::unique_ptr<ordered_workers<read_block>> read_ahead;
+  size_t next_block = 0;
+  /* for the entries of archive_next(), the archive they are read from (which
+   * `ar` belongs to) and the index of the entry */
+  std::shared_ptr<archive_cursor> cursor;
+  size_t cursor_index = 0;
+  /* with the entry cache, the contents of the entry, which are read from
+   * memory */
+  entry_data cached;
+};
+
+/* The entries of an archive to process, given either by position (1-based)
+ * or by name. An empty (NULL) selection matches every entry. */
+class entry_selection {
+private:
+  bool all_;
+  std::vector<R_xlen_t> indexes_;
+  std::vector<std::string> names_;
+
+public:
+  explicit entry_selection(const cpp11::sexp& file);
+  bool matches(R_xlen_t index, const char* filename) const;
+  /* true once `num_selected` entries have been found, so the caller can stop
+   * reading the rest of the archive */
+  bool done(size_t num_selected) const;
 };
 
+const char* strip_components(const char* p, int elements);
+
+/* The path, size and modification time of the entries of an archive, as
+ * returned by archive() */
+struct archive_listing {
+  std::vector<std::string> paths;
+  std::vector<__LA_INT64_T> sizes;
+  std::vector<time_t> dates;
+
+  void add(const char* path, int64_t size, time_t date);
+  SEXP as_tibble() const;
+};
+
+/* Set the type, size, mode and times of `entry` from `st` */
+void entry_copy_stat(struct archive_entry* entry, const struct stat* st);
+
+/* The format and filters detected for an archive opened for reading, which
+ * are only known after the first header has been read */
+void archive_detect(struct archive* a, int& format, std::vector<int>& filters);
+
+/* Read tar archives past the end of archive markers inside them, like
+ * `tar -i`, so the multi-member streams of archive_concat() are read whole.
+ * Does nothing if the tar format is not enabled on `a`. */
+void archive_read_concatenated(struct archive* a);
+
 size_t pop(void* target, size_t max, rchive* r);
 
+/* Add `n` bytes written to the archive_write connection `con` to its buffer,
+ * which is passed to archive_write_data() when full, so many small writes
+ * (e.g. from writeLines()) make few calls to libarchive */
+void rchive_write_buffered(Rconnection con, const void* data, size_t n);
+
+/* Pass any buffered data to archive_write_data() */
+void rchive_write_flush(Rconnection con);
+
 size_t push(rchive* r);
 
+/* Decode the rest of the current entry of `r` on another thread, up to
+ * `r->read_ahead_blocks` blocks ahead of push() */
+void start_read_ahead(rchive* r);
+
 ssize_t input_read(struct archive* a, void* client_data, const void** buff);
 int64_t
 input_seek(struct archive*, void* client_data, int64_t offset, int whence);
 int input_close(struct archive* a, void* client_data);
 
+/* Open `a` to read from `data`. A filename is opened by libarchive itself,
+ * or with `options(archive.mmap = TRUE)` memory mapped, a raw vector is read
+ * from memory and an R connection is read (and if possible seeked) through
+ * the input callbacks above. */
+void archive_read_open_input(struct archive* a, input_data* data);
+
+/* Enable the `format` and the `filters` (terminated by -1) to read, or all of
+ * them if -1, and set the options and password */
+void archive_read_support(
+    struct archive* a,
+    int format,
+    const int* filters,
+    const std::string& options,
+    const cpp11::strings& password);
+
+/* Like archive_read_support(), but an archive file which was read before with
+ * all formats and filters is read with the ones detected then, without
+ * bidding on its header again. Returns true if the format of the file should
+ * be remembered once a header has been read. */
+bool archive_read_support_input(
+    struct archive* a,
+    const input_data& input,
+    int format,
+    const int* filters,
+    const std::string& options,
+    const cpp11::strings& password);
+
+/* Remember the format and filters detected by `a` reading the archive file of
+ * `input`, after a header has been read */
+void archive_read_remember_format(struct archive* a, const input_data& input);
+
+size_t rchive_read(void* target, size_t sz, size_t ni, Rconnection con);
+int rchive_fgetc(Rconnection con);
+
 #if ARCHIVE_VERSION_NUMBER < 3000004
 int archive_write_add_filter(struct archive* a, int code);
 #endif
@@ -72,6 +209,13 @@ inline decltype(std::declval<Fun>()()) callback_unwind_protect(Fun&& fun) {
 
 #define call(f, ...) call_(__FILE__, __LINE__, #f, f, __VA_ARGS__)
 
+/* The R condition of an R function called from a libarchive callback (e.g. a
+ * write to a connection), which can't longjmp through libarchive. The
+ * callback stores it and reports a libarchive error, and call() raises it in
+ * place of that error. */
+void set_pending_unwind(SEXP token);
+SEXP take_pending_unwind();
+
 inline void archive_message(const char* msg) {
   static auto r_message = cpp11::package("base")["message"];
   r_message(msg);
@@ -132,7 +276,15 @@ inline int call_(
       if (msg) {
         archive_message(msg);
       }
-    } else if (msg) {
+      return response;
+    }
+    /* The handle is not freed here, callers free it as the error unwinds
+     * (so don't call() archive_write_free(), which frees it on error too) */
+    SEXP token = take_pending_unwind();
+    if (token != nullptr) {
+      R_ContinueUnwind(token);
+    }
+    if (msg) {
       Rf_errorcall(
           R_NilValue, "%s:%i %s(): %s", file_name, line, function_name, msg);
     } else {
@@ -201,4 +353,4 @@ public:
   operator cpp11::sexp() const { return connection_; }
 };
 
-[[cpp11::register]] void rchive_init(SEXP nc_xptr, SEXP rc_xptr);
+[[cpp11::register]] void rchive_init(SEXP nc_xptr, SEXP rc_xptr, SEXP wc_xptr);
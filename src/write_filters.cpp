@@ -0,0 +1,541 @@
+#include "r_archive.h"
+#include "write_filters.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <stdexcept>
+
+/* The amount of uncompressed data in each independently compressed block,
+ * large enough that the loss in compression from not sharing a dictionary
+ * between blocks is negligible */
+static const size_t PARALLEL_BLOCK_SIZE = 4 * 1024 * 1024;
+
+/* The number of blocks in a row which must agree before the adaptive level
+ * moves */
+static const int ADAPT_STREAK = 2;
+
+static bool is_block_parallel(int filter) {
+  return filter == ARCHIVE_FILTER_GZIP || filter == ARCHIVE_FILTER_BZIP2;
+}
+
+/* The range of levels used with `compression-level=adapt`, and the level of
+ * the first blocks. The slowest zstd levels are left out, as they need much
+ * more memory. */
+struct adaptive_levels {
+  int min;
+  int max;
+  int initial;
+};
+
+static bool adaptive_level_range(int filter, adaptive_levels& levels) {
+  switch (filter) {
+  case ARCHIVE_FILTER_GZIP:
+    levels = {1, 9, 6};
+    return true;
+  case ARCHIVE_FILTER_ZSTD:
+    levels = {1, 19, 3};
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Remove `compression-level=adapt` (possibly for a single module) from
+ * `options`, returns whether it was there */
+static bool take_adapt_option(std::string& options) {
+  bool found = false;
+  std::string rest;
+  size_t start = 0;
+  while (start <= options.size()) {
+    size_t end = options.find(',', start);
+    if (end == std::string::npos) {
+      end = options.size();
+    }
+    std::string option = options.substr(start, end - start);
+    start = end + 1;
+    std::string name = option.substr(option.find(':') + 1);
+    if (name == "compression-level=adapt") {
+      found = true;
+    } else if (!option.empty()) {
+      rest += (rest.empty() ? "" : ",") + option;
+    }
+  }
+  options = rest;
+  return found;
+}
+
+static la_ssize_t
+append_output(struct archive*, void* client_data, const void* buf, size_t n) {
+  std::string* out = static_cast<std::string*>(client_data);
+  out->append(static_cast<const char*>(buf), n);
+  return n;
+}
+
+/* A write archive with only `filter`, writing a single raw entry to memory */
+static struct archive* new_block_archive(int filter) {
+  struct archive* a = archive_write_new();
+  archive_write_set_format_raw(a);
+  archive_write_add_filter(a, filter);
+  archive_write_set_bytes_per_block(a, 0);
+  return a;
+}
+
+/* Compress `data` as a complete stream (e.g. one gzip member), runs on a
+ * worker thread so must not call the R API */
+static std::string
+compress_block(int filter, const std::string& options, std::vector<char> data) {
+  std::string out;
+  struct archive* a = new_block_archive(filter);
+  struct archive_entry* entry = archive_entry_new();
+  archive_entry_set_pathname(entry, "data");
+  archive_entry_set_filetype(entry, AE_IFREG);
+
+  bool ok = (options.empty() ||
+             archive_write_set_options(a, options.c_str()) == ARCHIVE_OK) &&
+            archive_write_open(a, &out, nullptr, append_output, nullptr) ==
+                ARCHIVE_OK &&
+            archive_write_header(a, entry) == ARCHIVE_OK &&
+            archive_write_data(a, data.data(), data.size()) ==
+                (la_ssize_t)data.size() &&
+            archive_write_close(a) == ARCHIVE_OK;
+
+  std::string error;
+  if (!ok) {
+    const char* msg = archive_error_string(a);
+    error = msg ? msg : "unknown libarchive error";
+  }
+  archive_entry_free(entry);
+  archive_write_free(a);
+
+  if (!ok) {
+    throw std::runtime_error(error);
+  }
+  return out;
+}
+
+/* The size of the writes to R connections */
+static const size_t CONNECTION_BUFFER_SIZE = 1024 * 1024;
+
+/* Where the archive is written to. Errors are thrown as exceptions. */
+class output_sink {
+public:
+  virtual ~output_sink() {}
+  virtual void write(const char* buf, size_t n) = 0;
+  virtual void close() = 0;
+};
+
+class file_sink : public output_sink {
+private:
+  std::string filename_;
+  FILE* fp_;
+
+public:
+  explicit file_sink(const std::string& filename)
+      : filename_(filename), fp_(fopen(filename.c_str(), "wb")) {
+    if (fp_ == nullptr) {
+      cpp11::stop(
+          "Could not open '%s' for writing: %s",
+          filename.c_str(),
+          strerror(errno));
+    }
+  }
+
+  ~file_sink() {
+    if (fp_ != nullptr) {
+      fclose(fp_);
+    }
+  }
+
+  void write(const char* buf, size_t n) override {
+    if (fwrite(buf, 1, n, fp_) != n) {
+      throw std::runtime_error(
+          "Could not write to '" + filename_ + "': " + strerror(errno));
+    }
+  }
+
+  void close() override {
+    FILE* fp = fp_;
+    fp_ = nullptr;
+    if (fclose(fp) != 0) {
+      throw std::runtime_error(
+          "Could not write to '" + filename_ + "': " + strerror(errno));
+    }
+  }
+};
+
+/* Collects libarchive's small blocks into large writes to an R connection.
+ * Called from libarchive's callbacks on the main thread. */
+class connection_sink : public output_sink {
+private:
+  SEXP connection_;
+  std::vector<char> buf_;
+  bool failed_ = false;
+
+  void write_all(const char* buf, size_t n) {
+    /* Nothing more is written after an error, e.g. while the archive is
+     * freed before the error is raised */
+    if (failed_) {
+      throw std::runtime_error("Could not write to the connection");
+    }
+    size_t written = 0;
+    /* Don't longjmp through libarchive (or past parallel_output's threads),
+     * call() raises the R condition once libarchive has returned */
+    try {
+      cpp11::unwind_protect([&] {
+        written = write_connection(connection_, buf, n);
+      });
+    } catch (const cpp11::unwind_exception& e) {
+      failed_ = true;
+      set_pending_unwind(e.token);
+      throw std::runtime_error("Could not write to the connection");
+    }
+    if (written != n) {
+      failed_ = true;
+      throw std::runtime_error("Could not write to the connection");
+    }
+  }
+
+  void flush() {
+    if (!buf_.empty()) {
+      write_all(buf_.data(), buf_.size());
+      buf_.clear();
+    }
+  }
+
+public:
+  explicit connection_sink(SEXP connection) : connection_(connection) {
+    buf_.reserve(CONNECTION_BUFFER_SIZE);
+  }
+
+  void write(const char* buf, size_t n) override {
+    if (buf_.size() + n > CONNECTION_BUFFER_SIZE) {
+      flush();
+    }
+    if (n >= CONNECTION_BUFFER_SIZE) {
+      write_all(buf, n);
+    } else {
+      buf_.insert(buf_.end(), buf, buf + n);
+    }
+  }
+
+  void close() override { flush(); }
+};
+
+/* libarchive callbacks, errors are reported through the archive rather than
+ * by throwing through libarchive's C frames */
+static la_ssize_t
+sink_write(struct archive* a, void* client_data, const void* buf, size_t n) {
+  try {
+    static_cast<output_sink*>(client_data)
+        ->write(static_cast<const char*>(buf), n);
+    return n;
+  } catch (const std::exception& e) {
+    archive_set_error(a, EIO, "%s", e.what());
+    return -1;
+  }
+}
+
+static int sink_close(struct archive* a, void* client_data) {
+  std::unique_ptr<output_sink> sink(static_cast<output_sink*>(client_data));
+  try {
+    sink->close();
+    return ARCHIVE_OK;
+  } catch (const std::exception& e) {
+    archive_set_error(a, EIO, "%s", e.what());
+    return ARCHIVE_FATAL;
+  }
+}
+
+/* Collects the output of the other filters in blocks, compresses them on
+ * worker threads and writes the results in order to the sink. */
+class parallel_output {
+private:
+  std::unique_ptr<output_sink> sink_;
+  parallel_filter filter_;
+  std::vector<char> block_;
+  std::deque<std::future<std::string>> pending_;
+  size_t num_blocks_ = 0;
+  adaptive_levels levels_;
+  int level_ = 0;
+  /* consecutive blocks which were ready (> 0) or not (< 0) */
+  int streak_ = 0;
+
+  void write_next() {
+    std::string out = pending_.front().get();
+    pending_.pop_front();
+    sink_->write(out.data(), out.size());
+  }
+
+  /* Like `zstd --adapt`, but the signal is only whether the oldest block was
+   * compressed before the next input block was full, not a measured rate: if
+   * it was the compression keeps up with the input and output, so the level
+   * can go up, if we have to wait for it the compression is the bottleneck,
+   * so it goes down. The level only moves after ADAPT_STREAK blocks in a row
+   * agree, so it settles rather than alternating between two levels. */
+  void adapt_level() {
+    bool ready = pending_.front().wait_for(std::chrono::seconds(0)) ==
+                 std::future_status::ready;
+    if (ready) {
+      streak_ = std::max(streak_, 0) + 1;
+    } else {
+      streak_ = std::min(streak_, 0) - 1;
+    }
+    if (std::abs(streak_) < ADAPT_STREAK) {
+      return;
+    }
+    level_ = std::max(
+        levels_.min, std::min(levels_.max, level_ + (ready ? 1 : -1)));
+    streak_ = 0;
+  }
+
+  void compress() {
+    /* Bound the memory used by the blocks in flight */
+    std::vector<std::string> done;
+    while (pending_.size() >= (size_t)filter_.threads) {
+      if (filter_.adapt) {
+        adapt_level();
+      }
+      done.push_back(pending_.front().get());
+      pending_.pop_front();
+    }
+    std::string options = filter_.options;
+    if (filter_.adapt) {
+      options += (options.empty() ? "" : ",") +
+                 std::string("compression-level=") + std::to_string(level_);
+    }
+    std::vector<char> block;
+    block.swap(block_);
+    pending_.push_back(std::async(
+        std::launch::async,
+        compress_block,
+        filter_.code,
+        std::move(options),
+        std::move(block)));
+    block_.reserve(PARALLEL_BLOCK_SIZE);
+    ++num_blocks_;
+
+    /* Written after the new block is started, so a slow output overlaps the
+     * compression */
+    for (const auto& out : done) {
+      sink_->write(out.data(), out.size());
+    }
+  }
+
+public:
+  parallel_output(output_sink* sink, const parallel_filter& filter)
+      : sink_(sink), filter_(filter) {
+    block_.reserve(PARALLEL_BLOCK_SIZE);
+    if (filter_.adapt) {
+      adaptive_level_range(filter_.code, levels_);
+      level_ = levels_.initial;
+    }
+  }
+
+  ~parallel_output() {
+    /* Wait for any blocks still being compressed after an error */
+    for (auto& f : pending_) {
+      f.wait();
+    }
+  }
+
+  void write(const char* buf, size_t n) {
+    while (n > 0) {
+      size_t len = std::min(n, PARALLEL_BLOCK_SIZE - block_.size());
+      block_.insert(block_.end(), buf, buf + len);
+      buf += len;
+      n -= len;
+      if (block_.size() == PARALLEL_BLOCK_SIZE) {
+        compress();
+      }
+    }
+  }
+
+  void close() {
+    /* An empty input still needs one (empty) compressed stream */
+    if (!block_.empty() || num_blocks_ == 0) {
+      compress();
+    }
+    while (!pending_.empty()) {
+      write_next();
+    }
+    sink_->close();
+  }
+};
+
+/* libarchive callbacks, errors are reported through the archive rather than
+ * by throwing through libarchive's C frames */
+static la_ssize_t parallel_output_write(
+    struct archive* a, void* client_data, const void* buf, size_t n) {
+  try {
+    static_cast<parallel_output*>(client_data)
+        ->write(static_cast<const char*>(buf), n);
+    return n;
+  } catch (const std::exception& e) {
+    archive_set_error(a, EIO, "%s", e.what());
+    return -1;
+  }
+}
+
+static int parallel_output_close(struct archive* a, void* client_data) {
+  std::unique_ptr<parallel_output> out(
+      static_cast<parallel_output*>(client_data));
+  try {
+    out->close();
+    return ARCHIVE_OK;
+  } catch (const std::exception& e) {
+    archive_set_error(a, EIO, "%s", e.what());
+    return ARCHIVE_FATAL;
+  }
+}
+
+parallel_filter archive_write_add_filters(
+    struct archive* a,
+    const std::vector<int>& filters,
+    int threads,
+    const std::string& options) {
+  parallel_filter pf;
+  pf.threads = threads;
+
+  std::string rest = options;
+  pf.adapt = take_adapt_option(rest);
+
+  size_t n = filters.size();
+  adaptive_levels levels;
+  if (pf.adapt) {
+    if (n == 0 || !adaptive_level_range(filters[n - 1], levels)) {
+      cpp11::stop("`compression-level=adapt` needs a gzip or zstd filter");
+    }
+    pf.code = filters[--n];
+  } else if (threads > 1 && n > 0 && is_block_parallel(filters[n - 1])) {
+    pf.code = filters[--n];
+  }
+
+  std::string num_threads = std::to_string(threads);
+  for (size_t i = 0; i < n; ++i) {
+    call(archive_write_add_filter, a, filters[i]);
+    if (threads <= 1) {
+      continue;
+    }
+    /* Older libarchive versions don't know the option, in which case the
+     * filter just uses one thread */
+    if (filters[i] == ARCHIVE_FILTER_XZ) {
+      archive_write_set_filter_option(a, "xz", "threads", num_threads.c_str());
+    }
+#if ARCHIVE_VERSION_NUMBER >= 3003003
+    if (filters[i] == ARCHIVE_FILTER_ZSTD) {
+      archive_write_set_filter_option(
+          a, "zstd", "threads", num_threads.c_str());
+    }
+#endif
+  }
+
+  return pf;
+}
+
+void archive_write_set_filter_options(
+    struct archive* a, std::string options, parallel_filter& pf) {
+  if (pf.adapt) {
+    take_adapt_option(options);
+  }
+  if (options.empty()) {
+    return;
+  }
+  if (pf.code == -1) {
+    call(archive_write_set_options, a, options.c_str());
+    return;
+  }
+
+  /* Each option goes to the parallel filter if it takes it, otherwise to the
+   * archive itself. Unqualified options, like compression-level, go to both */
+  struct archive* probe = new_block_archive(pf.code);
+  size_t start = 0;
+  while (start <= options.size()) {
+    size_t end = options.find(',', start);
+    if (end == std::string::npos) {
+      end = options.size();
+    }
+    std::string option = options.substr(start, end - start);
+    start = end + 1;
+    if (option.empty()) {
+      continue;
+    }
+    if (archive_write_set_options(probe, option.c_str()) == ARCHIVE_OK) {
+      pf.options += (pf.options.empty() ? "" : ",") + option;
+      archive_write_set_options(a, option.c_str());
+    } else if (archive_write_set_options(a, option.c_str()) != ARCHIVE_OK) {
+      /* Report why the filter rejected it, unless it was meant for another
+       * module */
+      std::string module = option.substr(0, option.find(':'));
+      bool other_module = module.size() < option.size() &&
+                          module != archive_filter_name(probe, 0);
+      const char* error = archive_error_string(other_module ? a : probe);
+      std::string msg = error ? error : "unknown libarchive error";
+      archive_write_free(probe);
+      cpp11::stop("archive_write_set_options(): %s", msg.c_str());
+    }
+  }
+  archive_write_free(probe);
+}
+
+void archive_write_open_output(
+    struct archive* a, const std::string& filename, const parallel_filter& pf) {
+  if (pf.code == -1) {
+    call(archive_write_open_filename, a, filename.c_str());
+    return;
+  }
+
+  /* Like archive_write_open_filename() does for regular files, don't pad
+   * the last block */
+  archive_write_set_bytes_in_last_block(a, 1);
+  parallel_output* out = new parallel_output(new file_sink(filename), pf);
+  call(
+      archive_write_open,
+      a,
+      out,
+      nullptr,
+      parallel_output_write,
+      parallel_output_close);
+}
+
+void archive_write_open_output(
+    struct archive* a, SEXP output, const parallel_filter& pf) {
+  if (TYPEOF(output) == STRSXP) {
+    archive_write_open_output(a, std::string(CHAR(STRING_ELT(output, 0))), pf);
+    return;
+  }
+
+  /* As for files, the size of the output is the size of the archive */
+  archive_write_set_bytes_in_last_block(a, 1);
+  if (pf.code == -1) {
+    call(
+        archive_write_open,
+        a,
+        new connection_sink(output),
+        nullptr,
+        sink_write,
+        sink_close);
+    return;
+  }
+  parallel_output* out =
+      new parallel_output(new connection_sink(output), pf);
+  call(
+      archive_write_open,
+      a,
+      out,
+      nullptr,
+      parallel_output_write,
+      parallel_output_close);
+}
+
+void archive_write_discard(struct archive* a, SEXP output) {
+  archive_write_free(a);
+  take_pending_unwind();
+  if (TYPEOF(output) == STRSXP) {
+    remove(CHAR(STRING_ELT(output, 0)));
+  }
+}
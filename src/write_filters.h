@@ -0,0 +1,51 @@
+#pragma once
+
+#include <archive.h>
+#include <cpp11/R.hpp>
+#include <string>
+#include <vector>
+
+/* The outermost write filter, when it is compressed by us in independent
+ * blocks on several threads rather than by libarchive. */
+struct parallel_filter {
+  int code = -1;
+  int threads = 1;
+  /* the options which apply to the filter */
+  std::string options;
+  /* whether the compression level is adapted to the speed of the output */
+  bool adapt = false;
+};
+
+/* Add `filters` to the write archive `a`, using up to `threads` threads to
+ * compress. zstd and xz use libarchive's own threading, an outermost gzip or
+ * bzip2 filter is instead compressed in blocks by `archive_write_open_output()`
+ * (the result is a valid multi-member stream).
+ *
+ * With `compression-level=adapt` in `options` an outermost gzip or zstd
+ * filter is always compressed in blocks. The level of the next block is
+ * raised while the earlier blocks are compressed before the next input block
+ * is full, and lowered while they are not (there is no measured rate). */
+parallel_filter archive_write_add_filters(
+    struct archive* a,
+    const std::vector<int>& filters,
+    int threads,
+    const std::string& options);
+
+/* Set the write `options` on `a`, options for the parallel filter are kept in
+ * `pf` */
+void archive_write_set_filter_options(
+    struct archive* a, std::string options, parallel_filter& pf);
+
+/* Open `a` for writing to `filename` */
+void archive_write_open_output(
+    struct archive* a, const std::string& filename, const parallel_filter& pf);
+
+/* Open `a` for writing to `output`, either a filename or an open R
+ * connection. Writes to connections are collected into large blocks. */
+void archive_write_open_output(
+    struct archive* a, SEXP output, const parallel_filter& pf);
+
+/* Free `a` after an error while writing to `output`, removing the partial
+ * archive if `output` is a filename. The R condition of a failed write to a
+ * connection is dropped, the error being handled is raised instead. */
+void archive_write_discard(struct archive* a, SEXP output);
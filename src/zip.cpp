@@ -0,0 +1,397 @@
+#include "zip.h"
+
+#include <cpp11.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+static const uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+static const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const uint32_t EOCD_SIGNATURE = 0x06054b50;
+static const uint32_t ZIP64_EOCD_SIGNATURE = 0x06064b50;
+static const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+static const uint16_t ZIP64_EXTRA_ID = 0x0001;
+
+static const size_t EOCD_SIZE = 22;
+static const size_t ZIP64_EOCD_SIZE = 56;
+static const size_t ZIP64_LOCATOR_SIZE = 20;
+static const size_t CENTRAL_HEADER_SIZE = 46;
+static const size_t LOCAL_HEADER_SIZE = 30;
+
+static const uint32_t MAX_32 = 0xFFFFFFFF;
+static const uint16_t MAX_16 = 0xFFFF;
+
+static uint16_t get16(const unsigned char* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const unsigned char* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const unsigned char* p) {
+  return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void put16(std::string& out, uint16_t x) {
+  out.push_back((char)(x & 0xFF));
+  out.push_back((char)((x >> 8) & 0xFF));
+}
+
+static void put32(std::string& out, uint32_t x) {
+  put16(out, (uint16_t)(x & 0xFFFF));
+  put16(out, (uint16_t)(x >> 16));
+}
+
+static void put64(std::string& out, uint64_t x) {
+  put32(out, (uint32_t)(x & MAX_32));
+  put32(out, (uint32_t)(x >> 32));
+}
+
+uint64_t zip_file_input::size() {
+  if (zip_fseek(fp_, 0, SEEK_END) != 0) {
+    cpp11::stop("Could not seek in zip file");
+  }
+  return zip_ftell(fp_);
+}
+
+void zip_file_input::read_at(uint64_t offset, void* buf, size_t n) {
+  if (zip_fseek(fp_, offset, SEEK_SET) != 0 || fread(buf, 1, n, fp_) != n) {
+    cpp11::stop("Unexpected end of zip file at offset %.0f", (double)offset);
+  }
+}
+
+void zip_memory_input::read_at(uint64_t offset, void* buf, size_t n) {
+  if (offset > data_.size() || n > data_.size() - offset) {
+    cpp11::stop("Unexpected end of zip file at offset %.0f", (double)offset);
+  }
+  memcpy(buf, data_.data() + offset, n);
+}
+
+/* Find the extra field `id` in `extra`, returning its data (or an empty
+ * string) and removing it from `extra` if `remove` is true. */
+static std::string
+take_extra_field(std::string& extra, uint16_t id, bool remove) {
+  size_t pos = 0;
+  while (pos + 4 <= extra.size()) {
+    const unsigned char* p = (const unsigned char*)extra.data() + pos;
+    uint16_t field_id = get16(p);
+    size_t field_size = get16(p + 2);
+    if (pos + 4 + field_size > extra.size()) {
+      break;
+    }
+    if (field_id == id) {
+      std::string out = extra.substr(pos + 4, field_size);
+      if (remove) {
+        extra.erase(pos, 4 + field_size);
+      }
+      return out;
+    }
+    pos += 4 + field_size;
+  }
+  return std::string();
+}
+
+std::vector<zip_entry>
+zip_read_central_directory(zip_input& in, std::string& comment) {
+  uint64_t file_size = in.size();
+  if (file_size < EOCD_SIZE) {
+    cpp11::stop("Not a zip file: end of central directory record not found");
+  }
+
+  /* The end of central directory record is followed by a comment of at most
+   * 64 KiB, so search for it backwards in the tail of the file. */
+  size_t tail_size =
+      (size_t)std::min<uint64_t>(file_size, EOCD_SIZE + MAX_16);
+  uint64_t tail_offset = file_size - tail_size;
+  std::vector<unsigned char> tail(tail_size);
+  in.read_at(tail_offset, tail.data(), tail_size);
+
+  ptrdiff_t eocd = -1;
+  for (ptrdiff_t i = tail_size - EOCD_SIZE; i >= 0; --i) {
+    if (get32(&tail[i]) == EOCD_SIGNATURE &&
+        i + EOCD_SIZE + get16(&tail[i + 20]) <= tail_size) {
+      eocd = i;
+      break;
+    }
+  }
+  if (eocd < 0) {
+    cpp11::stop("Not a zip file: end of central directory record not found");
+  }
+
+  const unsigned char* p = &tail[eocd];
+  if (get16(p + 4) != 0 || get16(p + 6) != 0) {
+    cpp11::stop("Multi-volume zip files are not supported");
+  }
+  uint64_t num_entries = get16(p + 10);
+  uint64_t cd_size = get32(p + 12);
+  uint64_t cd_offset = get32(p + 16);
+  comment.assign((const char*)p + EOCD_SIZE, get16(p + 20));
+
+  uint64_t eocd_offset = tail_offset + eocd;
+  if (eocd_offset >= ZIP64_LOCATOR_SIZE) {
+    unsigned char locator[ZIP64_LOCATOR_SIZE];
+    in.read_at(eocd_offset - ZIP64_LOCATOR_SIZE, locator, ZIP64_LOCATOR_SIZE);
+    if (get32(locator) == ZIP64_LOCATOR_SIGNATURE) {
+      unsigned char z64[ZIP64_EOCD_SIZE];
+      in.read_at(get64(locator + 8), z64, ZIP64_EOCD_SIZE);
+      if (get32(z64) != ZIP64_EOCD_SIGNATURE) {
+        cpp11::stop("Invalid zip64 end of central directory record");
+      }
+      num_entries = get64(z64 + 32);
+      cd_size = get64(z64 + 40);
+      cd_offset = get64(z64 + 48);
+    }
+  }
+
+  if (cd_offset + cd_size > file_size) {
+    cpp11::stop("Invalid zip central directory");
+  }
+
+  std::vector<unsigned char> cd(cd_size);
+  if (cd_size > 0) {
+    in.read_at(cd_offset, cd.data(), cd_size);
+  }
+
+  std::vector<zip_entry> out;
+  out.reserve(num_entries);
+
+  size_t pos = 0;
+  for (uint64_t i = 0; i < num_entries; ++i) {
+    if (pos + CENTRAL_HEADER_SIZE > cd.size() ||
+        get32(&cd[pos]) != CENTRAL_HEADER_SIGNATURE) {
+      cpp11::stop("Invalid zip central directory header for entry %.0f",
+                  (double)(i + 1));
+    }
+    const unsigned char* h = &cd[pos];
+    size_t name_length = get16(h + 28);
+    size_t extra_length = get16(h + 30);
+    size_t comment_length = get16(h + 32);
+    if (pos + CENTRAL_HEADER_SIZE + name_length + extra_length +
+            comment_length >
+        cd.size()) {
+      cpp11::stop("Invalid zip central directory header for entry %.0f",
+                  (double)(i + 1));
+    }
+
+    zip_entry e;
+    e.version_made_by = get16(h + 4);
+    e.version_needed = get16(h + 6);
+    e.flags = get16(h + 8);
+    e.method = get16(h + 10);
+    e.dos_time = get16(h + 12);
+    e.dos_date = get16(h + 14);
+    e.crc32 = get32(h + 16);
+    e.compressed_size = get32(h + 20);
+    e.uncompressed_size = get32(h + 24);
+    e.internal_attr = get16(h + 36);
+    e.external_attr = get32(h + 38);
+    e.local_header_offset = get32(h + 42);
+
+    const char* var = (const char*)h + CENTRAL_HEADER_SIZE;
+    e.name.assign(var, name_length);
+    e.extra.assign(var + name_length, extra_length);
+    e.comment.assign(var + name_length + extra_length, comment_length);
+
+    /* The zip64 field only holds the values whose 32 bit fields are
+     * saturated, in this order. */
+    std::string z64 = take_extra_field(e.extra, ZIP64_EXTRA_ID, true);
+    const unsigned char* z = (const unsigned char*)z64.data();
+    size_t z_pos = 0;
+    auto take64 = [&](uint64_t& value) {
+      if (value == MAX_32) {
+        if (z_pos + 8 > z64.size()) {
+          cpp11::stop("Invalid zip64 extra field in '%s'", e.name.c_str());
+        }
+        value = get64(z + z_pos);
+        z_pos += 8;
+        return true;
+      }
+      return false;
+    };
+    bool z_uncompressed = take64(e.uncompressed_size);
+    bool z_compressed = take64(e.compressed_size);
+    take64(e.local_header_offset);
+    e.zip64_sizes = z_uncompressed || z_compressed;
+
+    out.push_back(std::move(e));
+    pos += CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+  }
+
+  return out;
+}
+
+uint64_t zip_member_size(zip_input& in, const zip_entry& entry) {
+  unsigned char h[LOCAL_HEADER_SIZE];
+  in.read_at(entry.local_header_offset, h, LOCAL_HEADER_SIZE);
+  if (get32(h) != LOCAL_HEADER_SIGNATURE) {
+    cpp11::stop("Invalid local header for '%s'", entry.name.c_str());
+  }
+  uint16_t flags = get16(h + 6);
+  size_t name_length = get16(h + 26);
+  size_t extra_length = get16(h + 28);
+
+  uint64_t size = LOCAL_HEADER_SIZE + name_length + extra_length +
+                  entry.compressed_size;
+
+  /* bit 3: the CRC and sizes follow the data in a data descriptor, which uses
+   * 64 bit sizes if the local header has a zip64 extra field */
+  if (flags & 0x8) {
+    std::string extra(extra_length, '\0');
+    if (extra_length > 0) {
+      in.read_at(
+          entry.local_header_offset + LOCAL_HEADER_SIZE + name_length,
+          &extra[0],
+          extra_length);
+    }
+    bool zip64 = take_extra_field(extra, ZIP64_EXTRA_ID, false).size() > 0;
+
+    unsigned char signature[4];
+    in.read_at(entry.local_header_offset + size, signature, 4);
+    if (get32(signature) == DATA_DESCRIPTOR_SIGNATURE) {
+      size += 4;
+    }
+    size += 4 + (zip64 ? 16 : 8);
+  }
+
+  return size;
+}
+
+zip_writer::zip_writer(const std::string& filename) : filename_(filename) {
+  fp_ = fopen(filename.c_str(), "wb");
+  if (fp_ == nullptr) {
+    cpp11::stop(
+        "Could not open '%s' for writing: %s",
+        filename.c_str(),
+        strerror(errno));
+  }
+}
+
+zip_writer::~zip_writer() {
+  if (fp_ != nullptr) {
+    fclose(fp_);
+  }
+}
+
+void zip_writer::write(const void* data, size_t n) {
+  if (n > 0 && fwrite(data, 1, n, fp_) != n) {
+    cpp11::stop(
+        "Could not write to '%s': %s", filename_.c_str(), strerror(errno));
+  }
+  offset_ += n;
+}
+
+void zip_writer::copy(
+    zip_input& in, uint64_t offset, uint64_t n, std::vector<char>& buf) {
+  while (n > 0) {
+    size_t len = (size_t)std::min<uint64_t>(n, buf.size());
+    in.read_at(offset, buf.data(), len);
+    write(buf.data(), len);
+    offset += len;
+    n -= len;
+  }
+}
+
+void zip_writer::finish(const std::string& comment) {
+  uint64_t cd_offset = offset_;
+
+  std::string out;
+  for (const zip_entry& e : entries_) {
+    bool z_uncompressed = e.zip64_sizes || e.uncompressed_size >= MAX_32;
+    bool z_compressed = e.zip64_sizes || e.compressed_size >= MAX_32;
+    bool z_offset = e.local_header_offset >= MAX_32;
+
+    std::string z64;
+    if (z_uncompressed) {
+      put64(z64, e.uncompressed_size);
+    }
+    if (z_compressed) {
+      put64(z64, e.compressed_size);
+    }
+    if (z_offset) {
+      put64(z64, e.local_header_offset);
+    }
+    std::string extra;
+    if (!z64.empty()) {
+      put16(extra, ZIP64_EXTRA_ID);
+      put16(extra, (uint16_t)z64.size());
+      extra += z64;
+    }
+    extra += e.extra;
+
+    put32(out, CENTRAL_HEADER_SIGNATURE);
+    put16(out, e.version_made_by);
+    put16(
+        out,
+        z64.empty() ? e.version_needed
+                    : std::max<uint16_t>(e.version_needed, 45));
+    put16(out, e.flags);
+    put16(out, e.method);
+    put16(out, e.dos_time);
+    put16(out, e.dos_date);
+    put32(out, e.crc32);
+    put32(out, z_compressed ? MAX_32 : (uint32_t)e.compressed_size);
+    put32(out, z_uncompressed ? MAX_32 : (uint32_t)e.uncompressed_size);
+    put16(out, (uint16_t)e.name.size());
+    put16(out, (uint16_t)extra.size());
+    put16(out, (uint16_t)e.comment.size());
+    put16(out, 0);
+    put16(out, e.internal_attr);
+    put32(out, e.external_attr);
+    put32(out, z_offset ? MAX_32 : (uint32_t)e.local_header_offset);
+    out += e.name;
+    out += extra;
+    out += e.comment;
+
+    /* Don't hold the whole central directory of huge archives in memory */
+    if (out.size() > 1048576) {
+      write(out.data(), out.size());
+      out.clear();
+    }
+  }
+  write(out.data(), out.size());
+  out.clear();
+
+  uint64_t cd_size = offset_ - cd_offset;
+  uint64_t num_entries = entries_.size();
+
+  if (num_entries >= MAX_16 || cd_size >= MAX_32 || cd_offset >= MAX_32) {
+    uint64_t zip64_eocd_offset = offset_;
+    put32(out, ZIP64_EOCD_SIGNATURE);
+    put64(out, ZIP64_EOCD_SIZE - 12);
+    put16(out, 45);
+    put16(out, 45);
+    put32(out, 0);
+    put32(out, 0);
+    put64(out, num_entries);
+    put64(out, num_entries);
+    put64(out, cd_size);
+    put64(out, cd_offset);
+
+    put32(out, ZIP64_LOCATOR_SIGNATURE);
+    put32(out, 0);
+    put64(out, zip64_eocd_offset);
+    put32(out, 1);
+  }
+
+  put32(out, EOCD_SIGNATURE);
+  put16(out, 0);
+  put16(out, 0);
+  put16(out, (uint16_t)std::min<uint64_t>(num_entries, MAX_16));
+  put16(out, (uint16_t)std::min<uint64_t>(num_entries, MAX_16));
+  put32(out, (uint32_t)std::min<uint64_t>(cd_size, MAX_32));
+  put32(out, (uint32_t)std::min<uint64_t>(cd_offset, MAX_32));
+  put16(out, (uint16_t)std::min<size_t>(comment.size(), MAX_16));
+  out.append(comment, 0, std::min<size_t>(comment.size(), MAX_16));
+  write(out.data(), out.size());
+
+  if (fclose(fp_) != 0) {
+    fp_ = nullptr;
+    cpp11::stop(
+        "Could not write to '%s': %s", filename_.c_str(), strerror(errno));
+  }
+  fp_ = nullptr;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* Minimal support for the zip container itself, used where we copy or emit
+ * member data without going through libarchive's (de)compressors. Only what
+ * is needed to read a central directory and to write local headers, a
+ * central directory and the end of central directory records (including
+ * their zip64 variants) lives here.
+ *
+ * See https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+ */
+
+#if defined(_WIN32)
+#define zip_fseek _fseeki64
+#define zip_ftell _ftelli64
+#else
+#define zip_fseek fseeko
+#define zip_ftell ftello
+#endif
+
+/* Random access to the bytes of a zip file, on disk or in memory */
+class zip_input {
+public:
+  virtual ~zip_input() {}
+  virtual uint64_t size() = 0;
+  /* Read `n` bytes at `offset`, it is an error if there are fewer */
+  virtual void read_at(uint64_t offset, void* buf, size_t n) = 0;
+};
+
+class zip_file_input : public zip_input {
+private:
+  FILE* fp_;
+
+public:
+  explicit zip_file_input(FILE* fp) : fp_(fp) {}
+  uint64_t size() override;
+  void read_at(uint64_t offset, void* buf, size_t n) override;
+};
+
+class zip_memory_input : public zip_input {
+private:
+  const std::string& data_;
+
+public:
+  explicit zip_memory_input(const std::string& data) : data_(data) {}
+  uint64_t size() override { return data_.size(); }
+  void read_at(uint64_t offset, void* buf, size_t n) override;
+};
+
+struct zip_entry {
+  uint16_t version_made_by = 20;
+  uint16_t version_needed = 20;
+  uint16_t flags = 0;
+  uint16_t method = 0;
+  uint16_t dos_time = 0;
+  uint16_t dos_date = 0;
+  uint32_t crc32 = 0;
+  uint64_t compressed_size = 0;
+  uint64_t uncompressed_size = 0;
+  uint64_t local_header_offset = 0;
+  uint16_t internal_attr = 0;
+  uint32_t external_attr = 0;
+  std::string name;
+  /* extra fields, without the zip64 extended information, which is
+   * regenerated when writing */
+  std::string extra;
+  std::string comment;
+  /* the sizes were stored in the zip64 extra field of the input, keep them
+   * there so the local and central headers stay consistent */
+  bool zip64_sizes = false;
+};
+
+/* Read the central directory of the zip file `in`, the archive comment is
+ * stored in `comment` */
+std::vector<zip_entry>
+zip_read_central_directory(zip_input& in, std::string& comment);
+
+/* The number of bytes taken by the member `entry` in the input, from the
+ * start of its local header to the end of its data descriptor (if any) */
+uint64_t zip_member_size(zip_input& in, const zip_entry& entry);
+
+class zip_writer {
+private:
+  std::string filename_;
+  FILE* fp_;
+  uint64_t offset_ = 0;
+  std::vector<zip_entry> entries_;
+
+public:
+  explicit zip_writer(const std::string& filename);
+  ~zip_writer();
+
+  void write(const void* data, size_t n);
+
+  /* Copy `n` bytes from `in`, starting at `offset` */
+  void copy(zip_input& in, uint64_t offset, uint64_t n, std::vector<char>& buf);
+
+  /* Record `entry` for the central directory */
+  void add(const zip_entry& entry) { entries_.push_back(entry); }
+
+  uint64_t offset() const { return offset_; }
+
+  /* Write the central directory and end of central directory records */
+  void finish(const std::string& comment = std::string());
+};
@@ -0,0 +1,196 @@
+#include "r_archive.h"
+#include "compressibility.h"
+#include "ordered_workers.h"
+#include "zip.h"
+#include "zip_parallel.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Members larger than this are compressed to a temporary file rather than
+ * to memory */
+static const int64_t SPILL_SIZE = 8 * 1024 * 1024;
+
+/* The size of the reads from the member files */
+static const size_t READ_SIZE = 256 * 1024;
+
+/* A member compressed to a single member zip file */
+struct zip_result {
+  std::string data;
+  std::unique_ptr<FILE, int (*)(FILE*)> spill{nullptr, fclose};
+  uint64_t bytes_read = 0;
+  int64_t size = 0;
+  time_t mtime = 0;
+};
+
+static la_ssize_t
+append_output(struct archive*, void* client_data, const void* buf, size_t n) {
+  static_cast<std::string*>(client_data)
+      ->append(static_cast<const char*>(buf), n);
+  return n;
+}
+
+static void check(struct archive* a, int response) {
+  if (response < ARCHIVE_WARN) {
+    const char* msg = archive_error_string(a);
+    throw std::runtime_error(msg ? msg : "unknown libarchive error");
+  }
+}
+
+/* Runs on a worker thread, so must not call the R API; errors are thrown as
+ * std::runtime_error and reported by the main thread */
+static void compress_member(
+    const zip_member& member,
+    const std::string& options,
+    const char* password,
+    bool store_incompressible,
+    zip_result& result) {
+  std::unique_ptr<struct archive, int (*)(struct archive*)> a(
+      archive_write_new(), archive_write_free);
+  std::unique_ptr<struct archive_entry, void (*)(struct archive_entry*)> entry(
+      archive_entry_new(), archive_entry_free);
+
+  bool is_file = member.data == nullptr;
+  struct stat st;
+  if (is_file) {
+    if (member.has_stat) {
+      st = member.st;
+    } else if (stat(member.path.c_str(), &st) != 0) {
+      throw std::runtime_error(
+          "Could not stat '" + member.path + "': " + strerror(errno));
+    }
+    entry_copy_stat(entry.get(), &st);
+  } else {
+    archive_entry_set_filetype(entry.get(), AE_IFREG);
+    archive_entry_set_perm(entry.get(), 0644);
+    archive_entry_set_size(entry.get(), member.size);
+    archive_entry_set_mtime(entry.get(), time(NULL), 0);
+  }
+  archive_entry_set_pathname(entry.get(), member.name.c_str());
+  if (archive_entry_filetype(entry.get()) == AE_IFREG) {
+    result.size = archive_entry_size(entry.get());
+  }
+  result.mtime = archive_entry_mtime(entry.get());
+
+  check(a.get(), archive_write_set_format_zip(a.get()));
+  if (!options.empty()) {
+    check(a.get(), archive_write_set_options(a.get(), options.c_str()));
+  }
+  if (password != nullptr) {
+    check(a.get(), archive_write_set_passphrase(a.get(), password));
+  }
+  check(a.get(), archive_write_set_bytes_per_block(a.get(), 0));
+
+  if (archive_entry_size(entry.get()) > SPILL_SIZE) {
+    result.spill.reset(tmpfile());
+    if (result.spill == nullptr) {
+      throw std::runtime_error("Could not create a temporary file");
+    }
+    check(a.get(), archive_write_open_FILE(a.get(), result.spill.get()));
+  } else {
+    check(
+        a.get(),
+        archive_write_open(
+            a.get(), &result.data, nullptr, append_output, nullptr));
+  }
+
+  if (!is_file) {
+    if (store_incompressible) {
+      zip_set_member_compression(
+          a.get(), member.name, member.data, member.size);
+    }
+    check(a.get(), archive_write_header(a.get(), entry.get()));
+    if (member.size > 0 &&
+        archive_write_data(a.get(), member.data, member.size) < 0) {
+      check(a.get(), ARCHIVE_FATAL);
+    }
+    result.bytes_read = member.size;
+  } else if (archive_entry_filetype(entry.get()) == AE_IFREG) {
+    int fd = open(member.path.c_str(), O_RDONLY | O_BINARY);
+    if (fd == -1) {
+      throw std::runtime_error(
+          "Could not open '" + member.path + "': " + strerror(errno));
+    }
+    std::unique_ptr<int, void (*)(int*)> fd_closer(
+        &fd, [](int* fd) { close(*fd); });
+
+    /* The first block is read before the header, so the compression method
+     * can depend on it */
+    std::vector<char> buf(READ_SIZE);
+    ssize_t len = read(fd, buf.data(), buf.size());
+    if (store_incompressible) {
+      zip_set_member_compression(
+          a.get(), member.name, buf.data(), len > 0 ? len : 0);
+    }
+    check(a.get(), archive_write_header(a.get(), entry.get()));
+    while (len > 0) {
+      if (archive_write_data(a.get(), buf.data(), len) < 0) {
+        check(a.get(), ARCHIVE_FATAL);
+      }
+      result.bytes_read += len;
+      len = read(fd, buf.data(), buf.size());
+    }
+    if (len < 0) {
+      throw std::runtime_error(
+          "Could not read '" + member.path + "': " + strerror(errno));
+    }
+  } else {
+    check(a.get(), archive_write_header(a.get(), entry.get()));
+  }
+
+  check(a.get(), archive_write_close(a.get()));
+}
+
+void zip_write_parallel(
+    const std::string& filename,
+    const std::vector<zip_member>& members,
+    const std::string& options,
+    const char* password,
+    int threads,
+    const zip_progress& progress) {
+  zip_writer out(filename);
+  std::vector<char> buf(1024 * 1024);
+  uint64_t total_read = 0;
+  bool store_incompressible =
+      zip_store_incompressible(ARCHIVE_FORMAT_ZIP, options);
+
+  ordered_workers<zip_result> workers(
+      members.size(), threads, 2 * threads, [&](size_t i, zip_result& result) {
+        compress_member(
+            members[i], options, password, store_incompressible, result);
+      });
+
+  for (size_t i = 0; i < members.size(); ++i) {
+    zip_result result = workers.take(i);
+
+    std::unique_ptr<zip_input> in;
+    if (result.spill != nullptr) {
+      in.reset(new zip_file_input(result.spill.get()));
+    } else {
+      in.reset(new zip_memory_input(result.data));
+    }
+
+    std::string comment;
+    std::string name = members[i].name;
+    for (zip_entry entry : zip_read_central_directory(*in, comment)) {
+      name = entry.name;
+      uint64_t size = zip_member_size(*in, entry);
+      uint64_t offset = entry.local_header_offset;
+      entry.local_header_offset = out.offset();
+      out.copy(*in, offset, size, buf);
+      out.add(entry);
+    }
+
+    total_read += result.bytes_read;
+    progress(i, name, result.size, result.mtime, total_read);
+  }
+
+  out.finish();
+}
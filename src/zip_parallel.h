@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+/* A member of a zip file written by zip_write_parallel(), either the file
+ * `path` (with its `st`, if `has_stat`) or `size` bytes of `data` in memory */
+struct zip_member {
+  std::string name;
+  std::string path;
+  bool has_stat = false;
+  struct stat st;
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+/* Called on the main thread after member `i` is written, with its name as
+ * written (with a trailing `/` for directories), its uncompressed size and
+ * modification time and the number of uncompressed bytes written so far */
+typedef std::function<void(
+    size_t i, const std::string& name, int64_t size, time_t mtime, uint64_t)>
+    zip_progress;
+
+/* Write `members` to the new zip file `filename`, in order.
+ *
+ * Each member is compressed on one of `threads` worker threads by its own
+ * libarchive zip writer (so all of the zip `options` and encryption work as
+ * usual) into a single member zip file, in memory or for large members in a
+ * temporary file. The main thread then copies the local header and data of
+ * each member to the output and writes the central directory. */
+void zip_write_parallel(
+    const std::string& filename,
+    const std::vector<zip_member>& members,
+    const std::string& options,
+    const char* password,
+    int threads,
+    const zip_progress& progress);